@@ -0,0 +1,110 @@
+/*
+ * Serving cell to position table.
+ *
+ * Each cell the tracker gets a fix on is remembered with the latest
+ * position seen while it was serving, so a start without a recent
+ * position can still be seeded to within a cell's range. The table is
+ * small and kept whole in RAM, the least recently seen entry makes way
+ * for a new cell. It's written back when the serving cell changes, or
+ * at most every few minutes while moving within one.
+ */
+
+#include <api_fs.h>
+#include <api_network.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "celldb.h"
+
+#define CELL_FILE    "/t/cells"
+#define CELL_ENTRIES 32
+#define CELL_SAVE    30 // fixes between saves on the same cell, ~10s each
+
+typedef struct {
+  uint16_t mcc, mnc, lac, id;
+  float    lat, lon, alt;
+  uint32_t seen; // fix counter, for replacement
+} cell_t;
+
+static cell_t   table[CELL_ENTRIES];
+static cell_t   serving;
+static bool     known   = false;
+static cell_t*  current = NULL; // table entry for the serving cell, once fixed
+static uint32_t fixes   = 0;
+static uint32_t saved   = 0;
+
+static uint16_t Digits(const uint8_t* d) {
+  uint16_t v = 0;
+  for (int i = 0; i < 3 && d[i] <= 9; i++) v = v * 10 + d[i];
+  return v;
+}
+
+static bool Same(const cell_t* a, const cell_t* b) {
+  return a->id == b->id && a->lac == b->lac && a->mnc == b->mnc && a->mcc == b->mcc;
+}
+
+static cell_t* Find(const cell_t* c) {
+  for (int i = 0; i < CELL_ENTRIES; i++)
+    if (table[i].seen && Same(&table[i], c)) return &table[i];
+  return NULL;
+}
+
+static void Save() {
+  int32_t fd = API_FS_Open(CELL_FILE, FS_O_RDWR | FS_O_CREAT | FS_O_TRUNC, 0);
+  if (fd > 0) {
+    API_FS_Write(fd, (uint8_t*)table, sizeof(table));
+    API_FS_Close(fd);
+  }
+  saved = fixes;
+}
+
+void CELL_Load() {
+  int32_t fd = API_FS_Open(CELL_FILE, FS_O_RDONLY, 0);
+  if (fd <= 0) return;
+  if (API_FS_Read(fd, (uint8_t*)table, sizeof(table)) != sizeof(table)) memset(table, 0, sizeof(table));
+  API_FS_Close(fd);
+
+  // Carry on the fix counter so new entries rank above old ones
+  for (int i = 0; i < CELL_ENTRIES; i++)
+    if (table[i].seen > fixes) fixes = table[i].seen;
+  saved = fixes;
+}
+
+void CELL_Serving(const Network_Location_t* cell) {
+  cell_t c = {.mcc = Digits(cell->sMcc), .mnc = Digits(cell->sMnc), .lac = cell->sLac, .id = cell->sCellID};
+
+  if (known && Same(&c, &serving)) return;
+  if (current && fixes != saved) Save(); // leaving a cell, keep its last position
+  serving = c;
+  known   = true;
+  current = Find(&c);
+}
+
+bool CELL_Known() { return known; }
+
+void CELL_Fix(float lat, float lon, float alt) {
+  if (!known) return;
+  fixes++;
+
+  bool fresh = !current;
+  if (fresh) {
+    current = &table[0];
+    for (int i = 1; i < CELL_ENTRIES; i++)
+      if (table[i].seen < current->seen) current = &table[i];
+    *current = serving;
+  }
+  current->lat  = lat;
+  current->lon  = lon;
+  current->alt  = alt;
+  current->seen = fixes;
+
+  if (fresh || fixes - saved >= CELL_SAVE) Save();
+}
+
+bool CELL_Lookup(float* lat, float* lon, float* alt) {
+  if (!known || !current) return false;
+  *lat = current->lat;
+  *lon = current->lon;
+  *alt = current->alt;
+  return true;
+}
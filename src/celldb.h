@@ -0,0 +1,9 @@
+/*
+ * Serving cell to last known position table, for seeding GPS starts
+ */
+
+void CELL_Load();                                   // boot, read the table from SD
+void CELL_Serving(const Network_Location_t* cell);  // from API_EVENT_ID_NETWORK_CELL_INFO
+bool CELL_Known();                                  // have had a cell report
+void CELL_Fix(float lat, float lon, float alt);     // good fix while on the serving cell
+bool CELL_Lookup(float* lat, float* lon, float* alt); // position last seen on the serving cell
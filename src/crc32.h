@@ -0,0 +1,5 @@
+/*
+ * CRC-32 (IEEE), as zlib. Pass 0 to start, previous result to continue.
+ */
+
+uint32_t CRC32(uint32_t crc, const uint8_t* buf, int len);
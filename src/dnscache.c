@@ -0,0 +1,73 @@
+/*
+ * Server address cache.
+ *
+ * The SDK resolver doesn't hand back a TTL, so entries age against a
+ * configured one. The resolved address and when it was looked up are
+ * saved to SD, so after a reboot uploads can start from the cached
+ * address straight away and the refresh happens in the background.
+ * Ages need a set clock, an entry with an unknown age is used but
+ * refreshed once the time is known.
+ */
+
+#include <api_fs.h>
+#include <api_socket.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dnscache.h"
+
+#define DNSC_FILE  "/t/dns"
+#define DNSC_EPOCH 1577836800 // 2020, anything earlier and the clock isn't set
+#define DNSC_EARLY 10         // refresh once this percent of the ttl is left
+
+typedef struct {
+  char     host[128];
+  char     ip[16];
+  uint32_t resolved; // unix time, 0 if unknown
+} dnsc_t;
+
+static dnsc_t entry;
+static bool   stale = false;
+
+const char* DNSC_Load(const char* host) {
+  int32_t fd = API_FS_Open(DNSC_FILE, FS_O_RDONLY, 0);
+  if (fd <= 0) return entry.ip;
+  int32_t len = API_FS_Read(fd, (uint8_t*)&entry, sizeof(entry));
+  API_FS_Close(fd);
+  if (len != sizeof(entry) || strncmp(entry.host, host, sizeof(entry.host)) != 0) memset(&entry, 0, sizeof(entry));
+  entry.ip[sizeof(entry.ip) - 1] = 0;
+  return entry.ip;
+}
+
+const char* DNSC_Address() { return entry.ip; }
+
+bool DNSC_Resolve(const char* host) {
+  char ip[sizeof(entry.ip)] = {0};
+
+  if (DNS_GetHostByName2(host, ip) != 0 || !ip[0]) return false;
+
+  time_t now = time(NULL);
+  strncpy(entry.host, host, sizeof(entry.host) - 1);
+  strcpy(entry.ip, ip);
+  entry.resolved = now > DNSC_EPOCH ? now : 0;
+  stale          = false;
+
+  int32_t fd = API_FS_Open(DNSC_FILE, FS_O_RDWR | FS_O_CREAT | FS_O_TRUNC, 0);
+  if (fd > 0) {
+    API_FS_Write(fd, (uint8_t*)&entry, sizeof(entry));
+    API_FS_Close(fd);
+  }
+  return true;
+}
+
+int32_t DNSC_Due(const char* host, int32_t ttl) {
+  time_t now = time(NULL);
+
+  if (stale || !entry.ip[0] || strncmp(entry.host, host, sizeof(entry.host)) != 0) return 0;
+  if (now < DNSC_EPOCH) return 60; // look again when the clock is set
+  if (!entry.resolved) return 0;
+  return entry.resolved + ttl - ttl / DNSC_EARLY - now;
+}
+
+void DNSC_Expire() { stale = true; }
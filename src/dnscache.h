@@ -0,0 +1,9 @@
+/*
+ * Server address cache, kept on SD so boot can connect without a lookup
+ */
+
+const char* DNSC_Load(const char* host);              // boot, cached address for host or ""
+const char* DNSC_Address();                           // current address, "" if none
+bool        DNSC_Resolve(const char* host);           // blocking lookup, saves on success
+int32_t     DNSC_Due(const char* host, int32_t ttl);  // seconds until a refresh is due
+void        DNSC_Expire();                            // force a refresh, e.g. connect failures
@@ -0,0 +1,105 @@
+/*
+ * Main task event loop instrumentation.
+ * Per event id counts, log2 bucketed handler duration and inter-arrival
+ * histograms, all in fixed RAM.
+ *
+ * The queue can't be inspected, so depth is inferred: an event that is
+ * returned without OS_WaitEvent blocking was already queued behind the
+ * previous one. The longest such run is a lower bound on peak depth.
+ */
+
+#include <api_event.h>
+#include <api_os.h>
+#include <stdlib.h>
+
+#include "evstats.h"
+
+#define EVS_IDS (API_EVENT_ID_MAX + 1) // last slot catches unknown ids
+
+typedef struct {
+  uint32_t count;
+  uint16_t maxms;
+} evs_id_t;
+
+static evs_id_t ids[EVS_IDS];
+static uint32_t duration[EVS_BUCKETS]; // handler time
+static uint32_t gap[EVS_BUCKETS];      // time between arrivals
+static uint32_t total     = 0;
+static uint16_t maxdepth  = 0;
+static uint16_t depth     = 0;
+static uint32_t waitstart = 0;
+static uint32_t start     = 0;
+static uint32_t arrival   = 0;
+static uint32_t current   = 0;
+
+uint32_t EVS_Now() { return (uint32_t)(clock() / CLOCKS_PER_MSEC); }
+
+static int bucket(uint32_t ms) {
+  int b = 0;
+  while (ms && b < EVS_BUCKETS - 1) {
+    ms >>= 1;
+    b++;
+  }
+  return b; // 0: <1ms, n: 2^(n-1)..2^n-1 ms
+}
+
+void EVS_Reset() {
+  memset(ids, 0, sizeof(ids));
+  memset(duration, 0, sizeof(duration));
+  memset(gap, 0, sizeof(gap));
+  total    = 0;
+  maxdepth = 0;
+  depth    = 0;
+  arrival  = 0;
+}
+
+void EVS_Wait() { waitstart = EVS_Now(); }
+
+void EVS_Begin(uint32_t id) {
+  start   = EVS_Now();
+  current = (id < EVS_IDS - 1) ? id : EVS_IDS - 1;
+
+  // Didn't block, so it was already waiting
+  if (start == waitstart) {
+    if (++depth > maxdepth) maxdepth = depth;
+  } else
+    depth = 1;
+
+  if (total) gap[bucket(start - arrival)]++;
+  arrival = start;
+  total++;
+}
+
+void EVS_End() {
+  uint32_t ms = EVS_Now() - start;
+  duration[bucket(ms)]++;
+  ids[current].count++;
+  if (ms > ids[current].maxms) ids[current].maxms = ms > 0xffff ? 0xffff : ms;
+}
+
+// "a/b/c" counts up to the last used bucket
+static int histogram(char* buf, int size, uint32_t* hist) {
+  int last = 0;
+  for (int i = 0; i < EVS_BUCKETS; i++)
+    if (hist[i]) last = i;
+
+  int n = 0;
+  for (int i = 0; i <= last && n < size; i++) n += snprintf(buf + n, size - n, i ? "/%u" : "%u", hist[i]);
+  return n;
+}
+
+int EVS_Format(char* buf, int size, bool verbose) {
+  int n = snprintf(buf, size, "Events %u, depth %u\ndur ", total, maxdepth);
+  if (n < size) n += histogram(buf + n, size - n, duration);
+  if (n < size) n += snprintf(buf + n, size - n, "\ngap ");
+  if (n < size) n += histogram(buf + n, size - n, gap);
+
+  // id:count/max ms, only room for this on uart
+  if (verbose && n < size) {
+    n += snprintf(buf + n, size - n, "\nids");
+    for (int i = 0; i < EVS_IDS && n < size; i++)
+      if (ids[i].count) n += snprintf(buf + n, size - n, " %d:%u/%u", i, ids[i].count, ids[i].maxms);
+  }
+  if (n >= size) n = size - 1;
+  return n;
+}
@@ -0,0 +1,12 @@
+/*
+ * Main task event loop instrumentation
+ */
+
+#define EVS_BUCKETS 16 // log2 ms buckets, last is catch-all
+
+void     EVS_Wait();            // Call before blocking on the event queue
+void     EVS_Begin(uint32_t id); // Event received, handler starting
+void     EVS_End();             // Handler finished
+void     EVS_Reset();
+uint32_t EVS_Now(); // ms since boot
+int      EVS_Format(char* buf, int size, bool verbose);
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 
 #include "fsutil.h"
+#include "mempool.h"
 
 // Basic file exist check missing from API
 bool FileExists(char* file) {
@@ -25,7 +26,11 @@ bool CopyFile(char* src, char* dst) {
   fs = API_FS_Open(src, FS_O_RDONLY, 0);
   if (fs < 0) { return false; }
   len = API_FS_GetFileSize(fs);
-  buf = OS_Malloc(len + 16);
+  buf = POOL_Alloc(len + 16);
+  if (!buf) {
+    API_FS_Close(fs);
+    return false;
+  }
 
   fd = API_FS_Open(dst, FS_O_CREAT | FS_O_RDWR | FS_O_TRUNC, 0);
 
@@ -34,7 +39,7 @@ bool CopyFile(char* src, char* dst) {
 
   API_FS_Close(fs);
   API_FS_Close(fd);
-  OS_Free(buf);
+  POOL_Free(buf);
 
   return true;
 }
@@ -40,9 +40,24 @@
 #include "gps_parse.h"
 #include "ntp.h"
 
+#include "celldb.h"
+#include "dnscache.h"
+#include "evstats.h"
 #include "fsutil.h"
+#include "gpsstart.h"
+#include "ivrv2.h"
 #include "ledutil.h"
+#include "linkq.h"
+#include "logzip.h"
+#include "lzs.h"
+#include "mempool.h"
+#include "memstat.h"
 #include "oled.h"
+#include "sched.h"
+#include "sdwrite.h"
+#include "trackidx.h"
+#include "twheel.h"
+#include "xfer.h"
 
 #include "gps_monitor.h"
 
@@ -69,6 +84,8 @@
 #define MAIN_TASK_PRIORITY   0
 #define MAIN_TASK_NAME       "Main Task"
 
+#define REPLY_SIZE 256 // SMS/UART command reply
+
 #define SERVER_ADDRESS   ""
 #define SERVER_PORT      8181
 #define SOFT_VERSION     "V0.5.3"
@@ -85,10 +102,18 @@ typedef struct {
   int  gps;                                // Store GPS every
   int  upload;                             // Upload data every
   char server[128];                        // Tracking server
-  char server_ip[16];                      //
+  char server_ip[16];                      // Pinned address, else resolved and cached
   int  port;                               //
   int  loglevel;                           // Log to debug,file or uart
   int  screentime;                         // Turn off screen time
+  int  statslog;                           // Log event stats every n minutes
+  int  protocol;                           // Offer upload protocol 2 or stay on 1
+  int  udp;                                // Upload v2 batches over UDP
+  int  dnsttl;                             // Refresh the server address after seconds
+  int  maxstale;                           // Hold uploads in poor signal up to seconds
+  int  seedage;                            // Last position older than seconds, seed from the cell
+  int  live;                               // Keep a connection open and send fixes as they come
+  int  livewait;                           // ms to gather fixes before a live send
 } config_t;
 
 // global config with basic defaults
@@ -102,7 +127,15 @@ config_t config = {
     .server     = SERVER_ADDRESS,       // tracking server
     .port       = SERVER_PORT,          // server data port
     .loglevel   = DEBUG | TRACE | UART, // boot on full logging
-    .screentime = 60                    // screen off time
+    .screentime = 60,                   // screen off time
+    .statslog   = 0,                    // no periodic event stats
+    .protocol   = 1,                    // plain text uploads
+    .udp        = 0,                    // over tcp
+    .dnsttl     = 6 * 3600,             // re-resolve every 6 hours
+    .maxstale   = 1800,                 // upload anyway after 30 minutes
+    .seedage    = 2 * 3600,             // prefer the cell position after 2 hours
+    .live       = 0,                    // batch uploads
+    .livewait   = 1000                  // up to a second late to share a send
 };
 
 // Store last known state
@@ -114,7 +147,8 @@ typedef struct {
 } state_t;
 state_t state;
 
-bool nettime = false; // Have we got a nettime?
+bool nettime   = false;           // Have we got a nettime?
+int  rtcSource = GSTART_RTC_NONE; // and where from
 
 bool fota_on     = false;
 bool gpsReady    = false; // Global flag to prevent gps logging until all setup
@@ -127,6 +161,9 @@ bool mob_on  = false; // have we registered at all?
 bool dsk_on  = false; // data to write
 int  gps_num = 0;
 
+uint16_t battery_mv = 0; // sampled by the gprs task
+uint8_t  battery_pc = 0;
+
 // Save verbose diagnostics
 uint8_t logbuf[1024]; // TODO tidy up!
 
@@ -160,7 +197,12 @@ bool ListDirsRoot(char* path) {
 }
 
 #define BUFFER_SIZE 1024 // What's a sane "buffer"? 870bytes is ~5min
-char* sdbuffer;
+char*  sdbuffer;
+HANDLE bufferLock   = NULL; // fixes are added on the main task and taken to send on the gprs task
+int    bufferLogged = 0;    // bytes at the front already in the GPS log, put back after a failed send
+
+int           liveJob     = -1;
+volatile bool livePending = false; // a fix is waiting on the live job
 
 #define SMS_STORE SMS_STORAGE_SIM_CARD
 
@@ -213,14 +255,28 @@ void updateScreen(char* msg) {
 
 void refreshScreen() { updateScreen(stateMsg); }
 
+// Open on the SD writer
+int logFile      = -1;
+int cacheFile    = -1;
+int stateFile    = -1;
+int backfillFile = -1; // how far into the cache has been sent
+
+volatile bool cacheCleared = false; // ClearSD took the cache, the backfill offset is stale
+
 // Turn off oled before shutdown
 bool StoreCache(uint8_t*);
 void PowerOff() {
   OLED_off();
   StoreCache(sdbuffer); // Try to save any non uploaded data
+  SDW_FlushAll();
   PM_ShutDown();
 }
 
+void Restart() {
+  SDW_FlushAll();
+  PM_Restart();
+}
+
 // TODO rework this mess
 uint8_t* GetPair(uint8_t** key, uint8_t** val, uint8_t* line) {
   uint8_t* eol = strchr(line, '\n');
@@ -238,6 +294,8 @@ uint8_t* GetPair(uint8_t** key, uint8_t** val, uint8_t* line) {
   return eol;
 }
 
+bool oldServerIp = false; // config still has the lookup result older firmware saved
+
 // TODO rework this mess
 bool ReadConfig() {
   int32_t  fd;
@@ -254,7 +312,12 @@ bool ReadConfig() {
   len = API_FS_GetFileSize(fd);
   Output("File size %s, %d", path, len);
 
-  uint8_t* text = OS_Malloc(len + 2);
+  uint8_t* text = POOL_Alloc(len + 2);
+  if (!text) {
+    Output("ReadConfig: Malloc failure.");
+    API_FS_Close(fd);
+    return false;
+  }
   memset(text, 0, len + 2);
   uint32_t lenread = API_FS_Read(fd, text, len);
   strcat(text, "\n");
@@ -283,14 +346,32 @@ bool ReadConfig() {
         config.upload = strtol(val, 0, 0);
       else if (strcmp(key, "server") == 0)
         strncpy(config.server, val, 128);
-      else if (strcmp(key, "serverip") == 0)
+      else if (strcmp(key, "pinip") == 0)
         strncpy(config.server_ip, val, 16);
+      else if (strcmp(key, "serverip") == 0)
+        oldServerIp = true; // saved by older firmware from every lookup, not a pin
       else if (strcmp(key, "port") == 0)
         config.port = strtol(val, 0, 0);
       else if (strcmp(key, "log") == 0)
         config.loglevel = strtol(val, 0, 0);
       else if (strcmp(key, "screentime") == 0)
         config.screentime = strtol(val, 0, 0);
+      else if (strcmp(key, "statslog") == 0)
+        config.statslog = strtol(val, 0, 0);
+      else if (strcmp(key, "protocol") == 0)
+        config.protocol = strtol(val, 0, 0);
+      else if (strcmp(key, "udp") == 0)
+        config.udp = strtol(val, 0, 0);
+      else if (strcmp(key, "dnsttl") == 0)
+        config.dnsttl = strtol(val, 0, 0);
+      else if (strcmp(key, "maxstale") == 0)
+        config.maxstale = strtol(val, 0, 0);
+      else if (strcmp(key, "seedage") == 0)
+        config.seedage = strtol(val, 0, 0);
+      else if (strcmp(key, "live") == 0)
+        config.live = strtol(val, 0, 0);
+      else if (strcmp(key, "livewait") == 0)
+        config.livewait = strtol(val, 0, 0);
 
     } while (line++);
 
@@ -300,7 +381,7 @@ bool ReadConfig() {
 
     ret = true;
   }
-  OS_Free(text);
+  POOL_Free(text);
   return ret;
 }
 
@@ -311,7 +392,7 @@ bool WriteConfig() {
 
   Output("Update config file %s", path);
 
-  uint8_t* text = OS_Malloc(512); // more than enough
+  uint8_t* text = POOL_Alloc(512); // more than enough
   if (!text) {
     Output("WriteConfig: Malloc failure.");
     return false;
@@ -324,28 +405,39 @@ bool WriteConfig() {
            "gps: %d\n"
            "upload: %d\n"
            "server: %s\n"
-           "serverip: %s\n"
+           "pinip: %s\n"
            "port: %d\n"
            "log: %d\n"
-           "screentime: %d\n",
+           "screentime: %d\n"
+           "statslog: %d\n"
+           "protocol: %d\n"
+           "udp: %d\n"
+           "dnsttl: %d\n"
+           "maxstale: %d\n"
+           "seedage: %d\n"
+           "live: %d\n"
+           "livewait: %d\n",
            config.apn, config.apnuser, config.apnpwd, config.gps, config.upload, config.server, config.server_ip, config.port,
-           config.loglevel, config.screentime);
+           config.loglevel, config.screentime, config.statslog, config.protocol, config.udp, config.dnsttl,
+           config.maxstale, config.seedage, config.live, config.livewait);
 
   fd = API_FS_Open(path, FS_O_RDWR | FS_O_CREAT | FS_O_TRUNC, 0);
   if (fd < 0) {
     Output("Write file failed:%s, %d", path, fd);
-    OS_Free(text);
+    POOL_Free(text);
     return false;
   }
   ret = API_FS_Write(fd, (uint8_t*)text, strlen(text));
   API_FS_Flush(fd);
   API_FS_Close(fd);
-  OS_Free(text);
+  POOL_Free(text);
 
   if (ret <= 0) return false;
   return true;
 }
 
+int logzipJob = -1; // background compression of rolled logs
+
 void RollLog() {
   RTC_Time_t time;
   uint8_t    newpath[128];
@@ -354,27 +446,22 @@ void RollLog() {
   TIME_GetRtcTime(&time);
   sprintf(newpath, "%s/gps-%04d%02d%02d-%02d%02d%02d.log", FS_TFLASH_ROOT, time.year, time.month, time.day, time.hour, time.minute,
           time.second);
-  API_FS_Rename(path, newpath);
+  SDW_Close(logFile);
+  if (API_FS_Rename(path, newpath) == 0) TRK_Rolled(newpath);
   Output("GPS logfile rolled to %s", newpath);
-}
 
-// Flush any cache to SD
-bool SaveToSDLog() {
-  int32_t  fd;
-  uint8_t* path = (uint8_t*)GPS_LOG_FILE_PATH;
-  bool     ret  = true;
-
-  fd = API_FS_Open(path, FS_O_RDWR | FS_O_APPEND, 0);
+  LOGZ_Rolled();
+  SCHED_Set(logzipJob, 0);
+}
 
-  if (fd < 0) ret = false;
-  else if (API_FS_Write(fd, (uint8_t*)sdbuffer, strlen(sdbuffer)) < 0)
-    ret = false;
+// Add sent or sending fixes to the GPS log
+bool SaveToSDLog(const char* text) {
+  int64_t at  = SDW_Size(logFile);
+  bool    ret = SDW_Write(logFile, text, strlen(text));
+  if (ret && at >= 0) TRK_Add(text, strlen(text), at);
 
-  API_FS_Flush(fd);
-  int64_t logsize = API_FS_GetFileSize(fd);
-  API_FS_Close(fd);
-
-  if (!ret) { Output("SaveToSDLog: Open gps file %s failed:%d", path, fd); }
+  int64_t logsize = SDW_Size(logFile);
+  if (!ret) { Output("SaveToSDLog: write to %s failed", GPS_LOG_FILE_PATH); }
 
   if (logsize > ROLL_SIZE) RollLog();
 
@@ -389,9 +476,12 @@ bool ClearSD(bool gpsdata) {
   if (gpsdata) {
     char buff[64];
 
-    API_FS_Delete("/t/state");        // Last known state
-    API_FS_Delete("/t/cache");        // Cached GPS data
-    API_FS_Delete(GPS_LOG_FILE_PATH); // Current GPS log
+    SDW_Remove(stateFile, -1); // Last known state
+    SDW_Remove(cacheFile, -1); // Cached GPS data
+    SDW_Remove(backfillFile, -1);
+    cacheCleared = true;       // the gprs task resets its offset
+    SDW_Remove(logFile, -1);   // Current GPS log
+    TRK_Clear();               // Track index, the per log tables go with the logs
 
     // Now remove all rolled logfiles
     Dir_t* dir = API_FS_OpenDir("/t");
@@ -413,7 +503,7 @@ bool ClearSD(bool gpsdata) {
     OLED_on();
     updateScreen("Wiped, rebooting\nin 6 seconds...");
     OS_Sleep(6000);
-    PM_Restart();
+    Restart();
   }
   return true;
 }
@@ -428,40 +518,61 @@ bool StoreCache(uint8_t* buffer) {
   if (len == 0) // nothing to do
     return true;
 
-  int32_t fs = API_FS_Open("/t/cache", FS_O_RDWR | FS_O_APPEND | FS_O_CREAT, 0);
-  if (fs <= 0) {
-    ret = false;
-  } else {
-    if (API_FS_Write(fs, (uint8_t*)buffer, len) > 0) {
-      dsk_on = true; // caching to sd icon
-      ret    = true;
-    } else
-      ret = false;
-    API_FS_Close(fs);
-  }
+  ret = SDW_Write(cacheFile, buffer, len);
+  if (ret) dsk_on = true; // caching to sd icon
   return ret;
 }
 
 bool CacheGPS(char* str) {
 
-  if (strlen(sdbuffer) + strlen(str) > BUFFER_SIZE) {
+  OS_LockMutex(bufferLock);
+  if (strlen(sdbuffer) + strlen(str) >= BUFFER_SIZE) { // and the NUL
     // Full unflushed buffer, try to backup
     if (!StoreCache(sdbuffer)) Output("Unable to cache, discarded");
     else
       Output("Cached unsent to SD");
 
-    sdbuffer[0] = 0;
+    sdbuffer[0]  = 0;
+    bufferLogged = 0;
   }
   strcat(sdbuffer, str);
+  OS_UnlockMutex(bufferLock);
 
   // update last known state
-  int32_t fs = API_FS_Open("/t/state", FS_O_RDWR | FS_O_CREAT | FS_O_TRUNC, 0);
-  API_FS_Write(fs, (uint8_t*)&state, sizeof(state_t));
-  API_FS_Close(fs);
+  SDW_Write(stateFile, &state, sizeof(state_t));
 
   return true;
 }
 
+// Take the buffered fixes to send from a copy, so new ones can keep coming in meanwhile.
+// logged is how much of the front is in the GPS log already
+char* TakeBuffer(int* logged) {
+  char* copy = POOL_Alloc(BUFFER_SIZE);
+  if (!copy) return NULL;
+  OS_LockMutex(bufferLock);
+  strcpy(copy, sdbuffer);
+  *logged      = bufferLogged;
+  sdbuffer[0]  = 0;
+  bufferLogged = 0;
+  OS_UnlockMutex(bufferLock);
+  return copy;
+}
+
+// Put what's left of a taken copy back ahead of anything newer, or on SD if it won't fit
+void ReturnBuffer(char* copy) {
+  int len = strlen(copy);
+  OS_LockMutex(bufferLock);
+  int have = strlen(sdbuffer);
+  if (len + have < BUFFER_SIZE) {
+    memmove(sdbuffer + len, sdbuffer, have + 1);
+    memcpy(sdbuffer, copy, len);
+    bufferLogged = len; // logged when taken
+  } else if (!StoreCache(copy))
+    Output("Unable to cache, discarded");
+  OS_UnlockMutex(bufferLock);
+  POOL_Free(copy);
+}
+
 // Does registering with known network speed up the initial link?
 /*void Register()
 {
@@ -531,6 +642,10 @@ void HandleGps() {
     state.time.hour   = gpsInfo->rmc.time.hours;
     state.time.minute = gpsInfo->rmc.time.minutes;
     state.time.second = gpsInfo->rmc.time.seconds;
+    CELL_Fix(latitude, longitude, altitude);
+
+    int32_t ttff = GSTART_Fixed();
+    if (ttff >= 0) Output("TTFF %ds", ttff);
   }
 
   if ((last_state != gps_on) || (gps_num != num)) {
@@ -558,8 +673,8 @@ void HandleGps() {
   sprintf(datestr, "%02d%02d%02d%02d%02d%02d", gpsInfo->rmc.date.year, gpsInfo->rmc.date.month, gpsInfo->rmc.date.day,
           gpsInfo->rmc.time.hours, gpsInfo->rmc.time.minutes, gpsInfo->rmc.time.seconds);
 
-  uint8_t  percent;
-  uint16_t v = PM_Voltage(&percent);
+  uint8_t  percent = battery_pc;
+  uint16_t v       = battery_mv;
 
 #ifdef VERBOSE
   char satstr[128];
@@ -590,51 +705,125 @@ void HandleGps() {
            imei, datestr, latitude, longitude, fix, pace, altitude, isFixedStr, percent);
 
   CacheGPS(message);
+  if (config.live && !livePending) { // fixes until the job runs share its send
+    livePending = true;
+    SCHED_Poke(liveJob, config.livewait);
+  }
+}
+
+// Length delimited view onto a command, used in place on the event payload
+typedef struct {
+  const char* ptr;
+  int         len;
+} cmd_view_t;
+
+// Match and consume a leading keyword
+static bool CmdIs(cmd_view_t* cmd, const char* word) {
+  int n = strlen(word);
+  if (cmd->len < n || strnicmp(cmd->ptr, word, n) != 0) return false;
+  cmd->ptr += n;
+  cmd->len -= n;
+  return true;
+}
+
+// Split off next token, space or comma separated
+static bool CmdToken(cmd_view_t* cmd, cmd_view_t* tok) {
+  while (cmd->len && strchr(" ,\r\n", *cmd->ptr)) {
+    cmd->ptr++;
+    cmd->len--;
+  }
+  tok->ptr = cmd->ptr;
+  while (cmd->len && !strchr(" ,\r\n", *cmd->ptr)) {
+    cmd->ptr++;
+    cmd->len--;
+  }
+  tok->len = cmd->ptr - tok->ptr;
+  return tok->len > 0;
+}
+
+static void CmdCopy(cmd_view_t* tok, char* dst, int size) {
+  int n = tok->len < size - 1 ? tok->len : size - 1;
+  memcpy(dst, tok->ptr, n);
+  dst[n] = 0;
+}
+
+static int CmdInt(cmd_view_t* tok) {
+  char num[12];
+  CmdCopy(tok, num, sizeof(num));
+  return atol(num);
+}
+
+// Records from a track query go straight out, they won't fit a reply
+static void TrackOut(const char* line, int len) {
+  UART_Write(UART1, (uint8_t*)line, len);
+  WatchDog_KeepAlive();
 }
 
 // TODO make this smarter/slicker.
 // but. this will do for now.
 // TODO add file management
-bool handleCommand(bool  verbose, // verbose - sms or uart
-                   char* command, // will be changed/modified by tokeniser
-                   char* response // buffer for short reply
+bool handleCommand(bool        verbose, // verbose - sms or uart
+                   const char* command, // not terminated, left untouched
+                   int         len,     // command length
+                   char*       response // buffer for short reply
 ) {
+  cmd_view_t cmd = {command, len};
+  cmd_view_t arg;
+
   // get state. gprs, battery, gps.
-  if (strnicmp(command, "help", 4) == 0) {
-    sprintf(response, "Commands: info, poweroff, reboot, log, clear, apn <s> <u> "
-                      "<p>, frq <gps> <up>\n");
-  } else if (strnicmp(command, "info", 4) == 0) {
+  if (CmdIs(&cmd, "help")) {
+    sprintf(response, "Commands: info, stats, ttff, poweroff, reboot, log, track <from> [<to>], get <file> [<offset>], "
+                      "clear, apn <s> <u> <p>, frq <gps> <up>, live <0|1> [<ms>]\n");
+  } else if (CmdIs(&cmd, "info")) {
     uint8_t  percent;
     uint8_t  status;
     uint16_t v = PM_Voltage(&percent);
     Network_GetActiveStatus(&status);
     GPS_Info_t* gpsInfo = Gps_GetInfo();
 
-    sprintf(response,
-            "GPRS %d, Power %dmV %d%%, "
-            "FIX %d, "
-            "GPS %ds, UP %ds",
-            status, v, percent, gpsInfo->gga.satellites_tracked, config.gps, config.upload);
-
-  } else if (strnicmp(command, "poweroff", 8) == 0) // shutdown
+    int n = sprintf(response,
+                    "GPRS %d, Power %dmV %d%%, "
+                    "FIX %d, "
+                    "GPS %ds, UP %ds, ",
+                    status, v, percent, gpsInfo->gga.satellites_tracked, config.gps, config.upload);
+    n += LINKQ_Format(response + n, REPLY_SIZE - n);
+    n += snprintf(response + n, REPLY_SIZE - n, ", ");
+    if (n < REPLY_SIZE) n += GSTART_Format(response + n, REPLY_SIZE - n, false);
+    if (n < REPLY_SIZE) n += snprintf(response + n, REPLY_SIZE - n, ", ");
+    if (n < REPLY_SIZE) MEMSTAT_Format(response + n, REPLY_SIZE - n);
+
+  } else if (CmdIs(&cmd, "stats")) { // event loop timings, allocator and cpu use
+    int n = EVS_Format(response, REPLY_SIZE, verbose);
+    if (n < REPLY_SIZE - 2) {
+      response[n++] = '\n';
+      n += POOL_Format(response + n, REPLY_SIZE - n);
+    }
+    if (n < REPLY_SIZE - 2) {
+      response[n++] = '\n';
+      n += SCHED_Format(response + n, REPLY_SIZE - n);
+    }
+    if (n < REPLY_SIZE - 2) {
+      response[n++] = '\n';
+      SDW_Format(response + n, REPLY_SIZE - n);
+    }
+  } else if (CmdIs(&cmd, "ttff")) { // time to first fix by start type
+    GSTART_Format(response, REPLY_SIZE, true);
+  } else if (CmdIs(&cmd, "poweroff")) // shutdown
   {
     // Callback to shutdown so event removed from queue
     strcpy(response, "Poweroff in 5s");
     OS_StartCallbackTimer(mainTaskHandle, 5000, PowerOff, NULL);
-  } else if (strnicmp(command, "reboot", 5) == 0) // Reboot
+  } else if (CmdIs(&cmd, "reboot")) // Reboot
   {
     strcpy(response, "Reboot in 5s");
-    OS_StartCallbackTimer(mainTaskHandle, 5000, PM_Restart, NULL);
-  } else if (strnicmp(command, "apn ", 3) == 0) // iupdate apn info
+    OS_StartCallbackTimer(mainTaskHandle, 5000, Restart, NULL);
+  } else if (CmdIs(&cmd, "apn")) // iupdate apn info
   {
-    char* ptr    = &command[3];
-    char* server = strsep(&ptr, " ,\n");
-    char* user   = strsep(&ptr, " ,\n");
-    char* pwd    = strsep(&ptr, " ,\n");
-    if (server && user && pwd) {
-      strcpy(config.apn, server);
-      strcpy(config.apnuser, user);
-      strcpy(config.apnpwd, pwd);
+    cmd_view_t server, user, pwd;
+    if (CmdToken(&cmd, &server) && CmdToken(&cmd, &user) && CmdToken(&cmd, &pwd)) {
+      CmdCopy(&server, config.apn, PDP_APN_MAX_LENGTH);
+      CmdCopy(&user, config.apnuser, PDP_USER_NAME_MAX_LENGTH);
+      CmdCopy(&pwd, config.apnpwd, PDP_USER_PASSWD_MAX_LENGTH);
     }
     WriteConfig();
 
@@ -644,53 +833,113 @@ bool handleCommand(bool  verbose, // verbose - sms or uart
     strcpy(context.userPasswd, config.apnpwd);
     Network_StartActive(context);
     sprintf(response, "APN updated: %s", config.apn);
-  } else if (strnicmp(command, "frq ", 3) == 0) // Change save/upload times
+  } else if (CmdIs(&cmd, "frq")) // Change save/upload times
   {
-    char* ptr     = &command[3];
-    char* gps     = strsep(&ptr, " ,\n");
-    char* up      = strsep(&ptr, " ,\n");
-    config.gps    = atol(gps);
-    config.upload = atol(up);
+    cmd_view_t gps, up;
+    if (CmdToken(&cmd, &gps)) config.gps = CmdInt(&gps);
+    if (CmdToken(&cmd, &up)) config.upload = CmdInt(&up);
     WriteConfig();
 
     sprintf(response, "Times updated: %d %d", config.gps, config.upload);
-  } else if (strnicmp(command, "clear", 5) == 0) // Reset logfiles.
+  } else if (CmdIs(&cmd, "live")) // Hold a connection open and send each fix
+  {
+    cmd_view_t on, wait;
+    if (CmdToken(&cmd, &on)) config.live = CmdInt(&on);
+    if (CmdToken(&cmd, &wait)) config.livewait = CmdInt(&wait);
+    WriteConfig();
+    SCHED_Poke(liveJob, 0); // opens with the next fix, or closes
+
+    if (config.live) sprintf(response, "Live on, sends gather %dms", config.livewait);
+    else
+      strcpy(response, "Live off");
+  } else if (CmdIs(&cmd, "clear")) // Reset logfiles.
   {
     sprintf(response, "logs cleared");
     ClearSD(true); // full wipe and reboot
-  } else if (strnicmp(command, "loglevel ", 9) == 0) {
-    char* ptr       = &command[9];
-    char* lev       = strsep(&ptr, " ,\n");
-    config.loglevel = atol(lev);
+  } else if (CmdIs(&cmd, "loglevel ")) {
+    if (CmdToken(&cmd, &arg)) config.loglevel = CmdInt(&arg);
     WriteConfig();
     sprintf(response, "Log level %d", config.loglevel);
-  } else if (strnicmp(command, "log", 3) == 0) // read debug log and dump
+  } else if (CmdIs(&cmd, "track")) // records between two YYMMDDhhmmss times
+  {
+    cmd_view_t from, to;
+    char       stamp[13];
+    uint32_t   t0 = 0, t1 = 0xffffffff;
+
+    if (CmdToken(&cmd, &from)) {
+      CmdCopy(&from, stamp, sizeof(stamp));
+      t0 = TRK_Time(stamp);
+    }
+    if (CmdToken(&cmd, &to)) {
+      CmdCopy(&to, stamp, sizeof(stamp));
+      t1 = TRK_Time(stamp);
+    }
+    if (!t0 || !t1) {
+      strcpy(response, "track YYMMDDhhmmss [YYMMDDhhmmss]");
+      return true;
+    }
+    SDW_Flush(logFile); // current log as read from SD
+    sprintf(response, "Track: %d records\n", TRK_Query(t0, t1, TrackOut));
+  } else if (CmdIs(&cmd, "get")) // framed export of a file on /t, see xfer.h
+  {
+    cmd_view_t file, from;
+    char       path[64] = "/t/";
+
+    if (!verbose) { // the transfer goes out on UART1, nothing's there to receive it
+      strcpy(response, "get: serial only");
+      return true;
+    }
+    if (!CmdToken(&cmd, &file)) {
+      strcpy(response, "get <file> [<offset>]");
+      return true;
+    }
+    if (file.len > 3 && strncmp(file.ptr, "/t/", 3) == 0) CmdCopy(&file, path, sizeof(path));
+    else
+      CmdCopy(&file, path + 3, sizeof(path) - 3);
+    SDW_FlushAll(); // buffered logs as they stand
+    if (!XFER_Start(path, CmdToken(&cmd, &from) ? CmdInt(&from) : 0)) sprintf(response, "get: can't send %s", path);
+  } else if (CmdIs(&cmd, "log")) // read debug log and dump
   {
-    char buffer[1024];
+    uint8_t* buffer = POOL_Alloc(1024);
+    if (!buffer) {
+      strcpy(response, "Busy");
+      return true;
+    }
 
     int32_t logfile = API_FS_Open(GPS_LOG_FILE, FS_O_RDONLY, 0);
 
     while (!API_FS_IsEndOfFile(logfile)) {
-      int32_t len = API_FS_Read(logfile, buffer, 1024);
-      if (len > 0) {
-        UART_Write(UART1, buffer, len);
+      int32_t nread = API_FS_Read(logfile, buffer, 1024);
+      if (nread > 0) {
+        UART_Write(UART1, buffer, nread);
         WatchDog_KeepAlive();
       } else {
         break;
       }
     }
     API_FS_Close(logfile);
+    POOL_Free(buffer);
   } else
     return false; // not handled
 
   return true; // handled
 }
 
-static bool button_down = false;
-void        KeyHandler() {
+static bool       button_down = false;
+static tw_timer_t keyTimer;
+static tw_timer_t screenTimer;
+
+void ScreenOff(void* param) { OLED_off(); }
+
+// (Re)start the screen off countdown
+void ScreenTimeout() { TW_Start(&screenTimer, 1000 * config.screentime, 0, 1000, ScreenOff, NULL); }
+
+// Ticks every 500ms while the button is held
+void KeyHandler(void* param) {
   static uint32_t button_time = 0;
   if (button_time > 20) { // seems to be a button up on poweron
     button_time = 0;
+    TW_Cancel(&keyTimer);
     return;
   }
   button_time++;
@@ -711,21 +960,24 @@ void        KeyHandler() {
       sprintf(saveMsg, "Power off in %d", 6 - sec);
       updateScreen(saveMsg);
     }
-    OS_StartCallbackTimer(mainTaskHandle, 500, KeyHandler, NULL); // Keep ticking
   } else {
     {
+      TW_Cancel(&keyTimer);
       button_time = 0;
       bool oled   = OLED_state();
       if (oled) {
         OLED_off();
+        TW_Cancel(&screenTimer);
       } else {
         OLED_on();
+        ScreenTimeout();
         refreshScreen();
       }
     }
   }
 }
 
+void LinkBack(const char*);
 void EventNetwork(API_Event_t* pEvent) {
   switch (pEvent->id) {
       // TODO move network logic into network handler
@@ -753,6 +1005,7 @@ void EventNetwork(API_Event_t* pEvent) {
 
       mob_on = true;
       refreshScreen();
+      LinkBack("registered");
 
       uint8_t status = 0; // do we need to attach or reactivate?
       if (Network_GetAttachStatus(&status)) Output("GetAttach %d vs attachflag %d", status, netAttach);
@@ -811,20 +1064,13 @@ void EventNetwork(API_Event_t* pEvent) {
       dat_on = true;                     // data connection up
       Output("network activate success, connect");
       refreshScreen();
-
-      // Lookup server ip once if we need it.
-      if (strlen(config.server_ip) == 0) {
-        memset(config.server_ip, 0, sizeof(config.server_ip));
-        if (DNS_GetHostByName2(config.server, config.server_ip) != 0) {
-          Output("Get Host fail");
-          break;
-        }
-      }
-      break;
+      LinkBack("activated");
+      break; // server address is looked up by the gprs task
 
     case API_EVENT_ID_NETWORK_CELL_INFO: {
       uint8_t             number   = pEvent->param1;
       Network_Location_t* location = (Network_Location_t*)pEvent->pParam1;
+      if (number > 0) CELL_Serving(&location[0]); // first is the serving cell
       break;
     }
 
@@ -846,9 +1092,13 @@ void EventDispatch(API_Event_t* pEvent) {
       refreshScreen();
       break;
 
-    case API_EVENT_ID_SIGNAL_QUALITY:
+    case API_EVENT_ID_SIGNAL_QUALITY: {
       // param1: SQ(0~31,99(unknown)), param2:RXQUAL(0~7,99(unknown))  (RSSI = SQ*2-113)
+      bool poor = LINKQ_Poor();
+      LINKQ_Signal(pEvent->param1, pEvent->param2);
+      if (poor && !LINKQ_Poor()) LinkBack("signal good");
       break;
+    }
 
     case API_EVENT_ID_POWER_INFO:
       ////param1: (PM_Charger_State_t<<16|charge_level(%)) , param2:
@@ -856,7 +1106,8 @@ void EventDispatch(API_Event_t* pEvent) {
       break;
 
     case API_EVENT_ID_NETWORK_GOT_TIME: // Do we need to tell rtc/gps?
-      nettime = true;
+      nettime   = true;
+      rtcSource = GSTART_RTC_NET;
       RTC_Time_t time;
       TIME_GetRtcTime(&time);
       Output("GSM Time: %04d%02d%02d-%02d%02d%02d", //
@@ -866,7 +1117,8 @@ void EventDispatch(API_Event_t* pEvent) {
     case API_EVENT_ID_KEY_DOWN: // Start a keypress handler
       if (pEvent->param1 == KEY_POWER && !button_down) {
         button_down = true;
-        OS_StartCallbackTimer(mainTaskHandle, 500, KeyHandler, NULL);
+        TW_Start(&keyTimer, 500, 500, 0, KeyHandler, NULL);
+        if (OLED_state()) ScreenTimeout(); // Keep screen on while in use
       }
       break;
 
@@ -903,13 +1155,18 @@ void EventDispatch(API_Event_t* pEvent) {
       strncpy(number, &header[1], strcspn(&header[1], "\""));
 
       if (encodeType == SMS_ENCODE_TYPE_ASCII) {
-        char reply[256];
-        reply[0] = 0;
-        Output("message content:%s from %s", content, number);
+        Output("message content:%.*s from %s", pEvent->param2, content, number);
 
-        if (handleCommand(false, content, reply)) {
+        char* reply = POOL_Alloc(REPLY_SIZE);
+        if (!reply) {
+          Output("No reply buffer, SMS dropped");
+          break;
+        }
+        reply[0] = 0;
+        if (handleCommand(false, content, pEvent->param2, reply)) {
           if (strlen(reply)) SMS_SendMessage(number, reply, strlen(reply), SIM0);
         }
+        POOL_Free(reply);
       }
       break;
 
@@ -922,10 +1179,7 @@ void EventDispatch(API_Event_t* pEvent) {
              messageInfo->time.minute, messageInfo->time.second, messageInfo->time.timeZone);
 
       if (messageInfo->data) {
-        char message[256];
-        memset(message, 0, 256);
-        strncpy(message, messageInfo->data, messageInfo->dataLen);
-        Output("message content len:%d,data:%s\n", messageInfo->dataLen, message);
+        Output("message content len:%d,data:%.*s\n", messageInfo->dataLen, messageInfo->dataLen, messageInfo->data);
         // need to free data here
         OS_Free(messageInfo->data);
       }
@@ -951,15 +1205,21 @@ void EventDispatch(API_Event_t* pEvent) {
 
     case API_EVENT_ID_UART_RECEIVED:
       if (pEvent->param1 == UART1) {
+        if (XFER_Active()) { // acks for a file export
+          XFER_Input(pEvent->pParam1, pEvent->param2);
+          break;
+        }
         // TODO rework
         Output("uart received data, length:%d", pEvent->param2);
         if (pEvent->param2 && pEvent->pParam1) {
-          uint8_t data[pEvent->param2 + 1];
-          data[pEvent->param2] = 0;
-          memcpy(data, pEvent->pParam1, pEvent->param2);
-          char reply[256];
+          char* reply = POOL_Alloc(REPLY_SIZE);
+          if (!reply) {
+            Output("No reply buffer, command dropped");
+            break;
+          }
           reply[0] = 0;
-          if (handleCommand(true, data, reply)) { UART_Write(UART1, reply, strlen(reply)); }
+          if (handleCommand(true, pEvent->pParam1, pEvent->param2, reply)) { UART_Write(UART1, reply, strlen(reply)); }
+          POOL_Free(reply);
         }
       }
       break;
@@ -967,12 +1227,402 @@ void EventDispatch(API_Event_t* pEvent) {
   }
 }
 
+int  v2misses   = 0;     // hellos without an answer, give up offering v2 after a few
+bool v2commands = false; // server has said it may have commands for us
+
+#define V1_SERVER_FILE "/t/v1server" // server:port that turned down v2
+
+// Stop offering v2, and remember the server so later boots don't either
+void V2GiveUp() {
+  char id[160];
+  v2misses = 3;
+  Output("No v2 server, staying on v1");
+  int     n  = snprintf(id, sizeof(id), "%s:%d", config.server, config.port);
+  int32_t fd = API_FS_Open(V1_SERVER_FILE, FS_O_RDWR | FS_O_CREAT | FS_O_TRUNC, 0);
+  if (fd > 0) {
+    API_FS_Write(fd, (uint8_t*)id, n);
+    API_FS_Close(fd);
+  }
+}
+
+// Boot, whether the configured server already turned out to be v1
+bool V2Refused() {
+  char    id[160], was[160];
+  int     n  = snprintf(id, sizeof(id), "%s:%d", config.server, config.port);
+  int32_t fd = API_FS_Open(V1_SERVER_FILE, FS_O_RDONLY, 0);
+  if (fd <= 0) return false;
+  int32_t len = API_FS_Read(fd, (uint8_t*)was, sizeof(was));
+  API_FS_Close(fd);
+  return len == n && memcmp(was, id, n) == 0;
+}
+
+// Offer protocol v2, true if the server takes it
+bool V2Hello(int fd) {
+  char           msg[48];
+  fd_set         rd;
+  struct timeval tv = {.tv_sec = 5};
+
+  int n = snprintf(msg, sizeof(msg), V2_HELLO "%s#\n", imei);
+  if (send(fd, msg, n, 0) != n) return false;
+
+  FD_ZERO(&rd);
+  FD_SET(fd, &rd);
+  if (select(fd + 1, &rd, NULL, NULL, &tv) <= 0) { // v1 servers never answer
+    if (++v2misses == 3) V2GiveUp();
+    return false;
+  }
+  n = recv(fd, msg, sizeof(msg) - 1, 0);
+  if (n <= 0) return false;
+  msg[n]     = 0;
+  v2commands = strncmp(msg, V2_ACCEPT_CMD, strlen(V2_ACCEPT_CMD)) == 0;
+  if (!v2commands && strncmp(msg, V2_ACCEPT, strlen(V2_ACCEPT)) != 0) {
+    V2GiveUp();
+    return false;
+  }
+  v2misses = 0;
+  return true;
+}
+
+// Send buffered lines as v2 batches, on failure leave the unsent lines in data
+bool V2Upload(int fd, char* data, int len) {
+  bool     ret   = true;
+  int      size  = V2_HEADER + LZS_BOUND(V2_MAXRAW);
+  uint8_t* raw   = POOL_Alloc(V2_MAXRAW);
+  uint8_t* frame = POOL_Alloc(size);
+  int      off   = 0;
+  int      wire  = 0;
+
+  if (!raw || !frame) {
+    Output("V2Upload: Malloc failure.");
+    ret = false;
+  }
+  while (ret && off < len) {
+    int used;
+    int n = V2_Pack(imei, data + off, len - off, raw, frame, size, &used);
+    if (n == 0) { // only blank lines left
+      off += used;
+      continue;
+    }
+    if (n < 0) break;
+    for (int s = 0; s < n;) {
+      int retval = send(fd, frame + s, n - s, 0);
+      if (retval <= 0) {
+        Output("socket write fail:%d", retval);
+        ret = false;
+        break;
+      }
+      s += retval;
+    }
+    if (ret) {
+      off += used;
+      wire += n;
+    }
+  }
+  if (off < len) ret = false;
+  if (!ret && off) memmove(data, data + off, len - off + 1);
+  Output("v2 upload %d bytes as %d", off, wire);
+
+  POOL_Free(frame);
+  POOL_Free(raw);
+  return ret;
+}
+
+#define V2_CMD_WAIT 10000 // ms for the server's next frame, or for a command to run
+
+// Read exactly len bytes, false on close or if they're not all in within ms
+bool RecvAll(int fd, uint8_t* buf, int len, int ms) {
+  uint32_t until = EVS_Now() + ms;
+  fd_set   rd;
+
+  for (int got = 0; got < len;) {
+    int32_t left = until - EVS_Now();
+    if (left <= 0) return false;
+    struct timeval tv = {.tv_sec = left / 1000, .tv_usec = (left % 1000) * 1000};
+    FD_ZERO(&rd);
+    FD_SET(fd, &rd);
+    if (select(fd + 1, &rd, NULL, NULL, &tv) <= 0) return false;
+    int n = recv(fd, buf + got, len - got, 0);
+    if (n <= 0) return false;
+    got += n;
+  }
+  return true;
+}
+
+// A server command handed to the main task, where SMS and UART commands run.
+// busy stays set until the main task is done with cmd and reply, even after a
+// wait for it has timed out, so no poll writes a new command under it.
+struct {
+  char          cmd[256];
+  int           len;
+  char          reply[REPLY_SIZE];
+  bool          handled;
+  HANDLE        done;
+  volatile bool busy;
+} downlink;
+
+void DownlinkRun(void* param) {
+  downlink.reply[0] = 0;
+  downlink.handled  = handleCommand(false, downlink.cmd, downlink.len, downlink.reply);
+  OS_ReleaseSemaphore(downlink.done);
+  downlink.busy = false; // after the release, so the next poll drains it
+}
+
+// Fetch commands queued by the server after an upload, run each and send back its reply
+void V2Commands(int fd) {
+  uint8_t head[3] = {V2_POLL};
+  int     n       = 0;
+
+  if (downlink.busy) { // the last one is still running, the server keeps the rest queued
+    Output("server command still running, not polling");
+    return;
+  }
+  if (send(fd, head, 1, 0) != 1) return;
+  if (!downlink.done) downlink.done = OS_CreateSemaphore(0);
+  while (OS_WaitForSemaphore(downlink.done, OS_TIME_OUT_NO_WAIT)) // one that ran late last time
+    ;
+
+  while (RecvAll(fd, head, 1, V2_CMD_WAIT) && head[0] == V2_CMD) { // V2_DONE is the type alone
+    if (!RecvAll(fd, head + 1, 1, V2_CMD_WAIT)) break;
+    downlink.len = head[1];
+    if (!RecvAll(fd, (uint8_t*)downlink.cmd, downlink.len, V2_CMD_WAIT)) break;
+    Output("server command: %.*s", downlink.len, downlink.cmd);
+
+    downlink.busy = true;
+    OS_StartCallbackTimer(mainTaskHandle, 1, DownlinkRun, NULL);
+    if (!OS_WaitForSemaphore(downlink.done, V2_CMD_WAIT)) {
+      Output("server command didn't finish");
+      break;
+    }
+    const char* reply = downlink.handled ? downlink.reply : "Unknown command";
+    int         len   = strlen(reply);
+    head[0]           = V2_REPLY;
+    head[1]           = len & 0xff;
+    head[2]           = len >> 8;
+    if (send(fd, head, 3, 0) != 3 || send(fd, reply, len, 0) != len) break;
+    n++;
+  }
+  if (n) Output("%d server commands", n);
+}
+
+// Pinned in the config or from the resolver cache
+const char* ServerIp() { return config.server_ip[0] ? config.server_ip : DNSC_Address(); }
+
+void ServerAddr(struct sockaddr_in* sockaddr) {
+  memset(sockaddr, 0, sizeof(*sockaddr));
+  sockaddr->sin_family = AF_INET;
+  sockaddr->sin_port   = htons(config.port);
+  inet_pton(AF_INET, ServerIp(), &sockaddr->sin_addr);
+}
+
+#define DNS_MINTTL 60 // s, lower dnsttl would have the job looking up all the time
+
+int dnsJob    = -1;
+int connfails = 0; // in a row, re-resolve after a couple
+
+// Keep the cached server address fresh, blocking lookups stay off the event thread
+void DnsJob() {
+  int32_t ttl = config.dnsttl < DNS_MINTTL ? DNS_MINTTL : config.dnsttl;
+  int32_t due = DNSC_Due(config.server, ttl);
+  if (due <= 0) {
+    if (DNSC_Resolve(config.server)) {
+      Output("Resolved %s to %s", config.server, DNSC_Address());
+      due = DNSC_Due(config.server, ttl);
+    } else {
+      Output("Get Host fail");
+      due = 60;
+    }
+  }
+  if (due > ttl) due = ttl; // clock jumped back
+  if (due < 1) due = 1;
+  SCHED_Set(dnsJob, due * 1000);
+}
+
+#define UDP_WINDOW 8    // datagrams in flight
+#define UDP_TRIES  3    // sends of each before falling back to tcp
+#define UDP_WAIT   3000 // ms to wait for acks after each send
+
+uint16_t udpboot   = 0; // boot count, so the server can tell this boot's sequences from the last one's
+uint16_t udpseq    = 0;
+int      udpmisses = 0; // uploads that fell back to tcp, give up on udp after a few
+
+#define BOOTS_FILE "/t/boots"
+
+void CountBoot() {
+  int32_t fd = API_FS_Open(BOOTS_FILE, FS_O_RDWR | FS_O_CREAT, 0);
+  if (fd <= 0) {
+    Output("Unable to count boots, udp sequences may repeat");
+    return;
+  }
+  API_FS_Read(fd, (uint8_t*)&udpboot, sizeof(udpboot));
+  udpboot++;
+  API_FS_Seek(fd, 0, FS_SEEK_SET);
+  API_FS_Write(fd, (uint8_t*)&udpboot, sizeof(udpboot));
+  API_FS_Close(fd);
+}
+
+// Wait for acks on a window, returns how many are still outstanding
+int UdpAcks(int fd, uint16_t* seqs, bool* acked, int n, int pending) {
+  uint32_t until = EVS_Now() + UDP_WAIT;
+  uint8_t  ack[5];
+  fd_set   rd;
+
+  while (pending) {
+    int32_t left = until - EVS_Now();
+    if (left <= 0) break;
+    struct timeval tv = {.tv_sec = left / 1000, .tv_usec = (left % 1000) * 1000};
+    FD_ZERO(&rd);
+    FD_SET(fd, &rd);
+    if (select(fd + 1, &rd, NULL, NULL, &tv) <= 0) break;
+    if (recv(fd, ack, sizeof(ack), 0) != sizeof(ack) || ack[0] != V2_ACK) continue;
+    if ((ack[1] | (ack[2] << 8)) != udpboot) continue; // for an earlier boot
+
+    uint16_t seq = ack[3] | (ack[4] << 8);
+    for (int i = 0; i < n; i++)
+      if (seqs[i] == seq && !acked[i]) {
+        acked[i] = true;
+        pending--;
+      }
+  }
+  return pending;
+}
+
+// Send buffered lines as acked v2 datagrams, on failure leave the unsent lines in data
+bool UdpUpload(char* data) {
+  int      len     = strlen(data);
+  int      total   = len;
+  int      partial = 0; // bytes acked in a window that didn't all get through
+  int      size    = 6 + sizeof(imei) + V2_HEADER + LZS_BOUND(V2_MAXRAW);
+  uint8_t* raw     = POOL_Alloc(V2_MAXRAW);
+  uint8_t* dgram   = POOL_Alloc(size);
+  int      off     = 0;
+  int      wire    = 0;
+  uint32_t start   = EVS_Now();
+  int      fd      = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+  if (fd < 0 || !raw || !dgram) {
+    Output("UdpUpload: socket or malloc failure.");
+    if (fd >= 0) close(fd);
+    POOL_Free(dgram);
+    POOL_Free(raw);
+    return false;
+  }
+
+  LED_data(true);
+
+  struct sockaddr_in sockaddr;
+  ServerAddr(&sockaddr);
+
+  int ilen = strlen(imei);
+  int hlen = 6 + ilen;
+  dgram[0] = V2_DGRAM;
+  dgram[1] = udpboot & 0xff;
+  dgram[2] = udpboot >> 8;
+  dgram[5] = ilen;
+  memcpy(dgram + 6, imei, ilen);
+
+  while (off < len) {
+    int      offs[UDP_WINDOW], useds[UDP_WINDOW];
+    uint16_t seqs[UDP_WINDOW];
+    bool     acked[UDP_WINDOW];
+    int      n = 0;
+    int      o = off;
+    int      used;
+
+    // Carve the next window into datagrams, each repacked on send rather than held
+    for (; n < UDP_WINDOW && o < len; n++) {
+      int f = V2_Pack(imei, data + o, len - o, raw, dgram + hlen, size - hlen, &used);
+      if (f == 0) o += used; // only blank lines left
+      if (f <= 0) break;
+      offs[n]  = o;
+      useds[n] = used;
+      seqs[n]  = udpseq++;
+      acked[n] = false;
+      o += used;
+    }
+    if (!n) {
+      off = o;
+      break;
+    }
+
+    int pending = n;
+    for (int t = 0; t < UDP_TRIES && pending; t++) {
+      for (int i = 0; i < n; i++) {
+        if (acked[i]) continue;
+        int f    = V2_Pack(imei, data + offs[i], useds[i], raw, dgram + hlen, size - hlen, &used);
+        dgram[3] = seqs[i] & 0xff;
+        dgram[4] = seqs[i] >> 8;
+        if (sendto(fd, dgram, hlen + f, 0, (struct sockaddr*)&sockaddr, sizeof(sockaddr)) > 0) wire += hlen + f;
+      }
+      pending = UdpAcks(fd, seqs, acked, n, pending);
+    }
+    if (pending) { // the tcp fallback resends only what wasn't acked
+      int keep = off;
+      for (int i = 0; i < n; i++) {
+        if (acked[i]) {
+          partial += useds[i];
+          continue;
+        }
+        memmove(data + keep, data + offs[i], useds[i]);
+        keep += useds[i];
+      }
+      memmove(data + keep, data + o, len - o + 1);
+      len -= o - keep;
+      break;
+    }
+    off = o;
+  }
+  close(fd);
+  POOL_Free(dgram);
+  POOL_Free(raw);
+  LED_data(false);
+
+  Output("udp upload %d of %d bytes as %d, %dms", off + partial, total, wire, EVS_Now() - start);
+  if (off < len) {
+    if (++udpmisses == 3) Output("UDP losing too much, staying on tcp");
+    memmove(data, data + off, len - off + 1);
+    return false;
+  }
+  udpmisses = 0;
+  return true;
+}
+
+// Send buffered lines as v1 text, on failure leave the unsent lines in data
+bool V1Upload(int fd, char* data, int len) {
+  bool  ret  = true;
+  char* curs = data;
+  char* line;
+  int   llen;
+
+  // Tokenise and write each line
+  while ((line = strsep(&curs, "\n")) && (llen = strlen(line))) {
+#ifdef VERBOSE
+    Output("Writing %d bytes. '%s'", llen, line);
+#endif
+    int retval = send(fd, line, llen, 0);
+    if (retval < 0) {
+      Output("socket write fail:%d", retval);
+      line[llen] = '\n'; // detokenize this line
+      curs       = line; // set cursor back to line start
+      ret        = false;
+      break;
+    }
+  }
+  if (!ret && curs != data) // If failed but still copied some, remove from buffer
+  {
+    memmove(data, curs, len - (curs - data) + 1);
+  }
+  return ret;
+}
+
 /*
  * Connect and send data, synchronous connection code
  */
 bool UploadToServer(char* data) {
   bool ret = true;
-  int  len = strlen(data);
+  int  len;
+
+  if (config.udp && udpmisses < 3 && UdpUpload(data)) return true;
+  len = strlen(data);
 
   // Connect
   int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -986,44 +1636,57 @@ bool UploadToServer(char* data) {
   LED_data(true);
 
   struct sockaddr_in sockaddr;
-  memset(&sockaddr, 0, sizeof(sockaddr));
-  sockaddr.sin_family = AF_INET;
-  sockaddr.sin_port   = htons(config.port);
-  inet_pton(AF_INET, config.server_ip, &sockaddr.sin_addr);
+  ServerAddr(&sockaddr);
 
   int retval = connect(fd, (struct sockaddr*)&sockaddr, sizeof(struct sockaddr_in));
+  if (retval >= 0) connfails = 0;
 
   if (retval < 0) {
-    Output("Socket connect fail %d ip:%s, port:%d", retval, config.server_ip, config.port);
+    Output("Socket connect fail %d ip:%s, port:%d", retval, ServerIp(), config.port);
     ret = false;
-  } else {
-    // Tokenise and write each line
-    char* curs = data;
-    char* line;
-    int   llen;
-    while ((line = strsep(&curs, "\n")) && (llen = strlen(line))) {
-#ifdef VERBOSE
-      Output("Writing %d bytes. '%s'", llen, line);
-#endif
-      retval = send(fd, line, llen, 0);
-      if (retval < 0) {
-        Output("socket write fail:%d", retval);
-        line[llen] = '\n'; // detokenize this line
-        curs       = line; // set cursor back to line start
-        ret        = false;
-        break;
-      }
-    }
-    if (!ret && curs != data) // If failed but still copied some, remove from buffer
-    {
-      memcpy(data, curs, len - (curs - data));
+    if (++connfails >= 2 && !config.server_ip[0]) { // moved server?
+      connfails = 0;
+      DNSC_Expire();
+      SCHED_Set(dnsJob, 0);
     }
+  } else if (config.protocol == 2 && v2misses < 3 && V2Hello(fd)) {
+    ret = V2Upload(fd, data, len);
+    if (ret && v2commands) V2Commands(fd);
+    close(fd);
+  } else {
+    ret = V1Upload(fd, data, len);
     close(fd);
   }
   LED_data(false);
   return ret;
 }
 
+// Seconds since 1970 for comparing RTC times
+int32_t RtcSeconds(RTC_Time_t* t) {
+  int     y   = t->year - (t->month <= 2);
+  int     era = y / 400;
+  int     yoe = y - era * 400;
+  int     doy = (153 * (t->month + (t->month > 2 ? -3 : 9)) + 2) / 5 + t->day - 1;
+  int32_t day = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+  return day * 86400 + t->hour * 3600 + t->minute * 60 + t->second;
+}
+
+// Seconds since the last known position, -1 if the clock or state isn't usable
+int32_t StateAge() {
+  RTC_Time_t now;
+  TIME_GetRtcTime(&now);
+  if (now.year < 2020 || state.time.year < 2020) return -1;
+  int32_t age = RtcSeconds(&now) - RtcSeconds(&state.time);
+  return age < 0 ? -1 : age;
+}
+
+// Position last seen on the serving cell, asks the modem which cell that is
+bool CellSeed(float* lat, float* lon, float* alt) {
+  if (!CELL_Known()) Network_GetCellInfoRequst();
+  for (int i = 0; i < 50 && !CELL_Known(); i++) OS_Sleep(100);
+  return CELL_Lookup(lat, lon, alt);
+}
+
 /*
  * initialise gps params and start logging activity
  */
@@ -1082,9 +1745,26 @@ void InitialiseGPS() {
   }
   Output("Set search mode %s (%d tries)", ret ? "ok" : "fail", retries);
 
-  // Try fast start from cached last known location if we know one
-  if (state.latitude != 0 && state.longitude != 0) {
-    updateScreen("GPS hot start");
+  // Pick a start from how old and how far away the last fix is, and how good the clock is
+  float    lat = state.latitude, lon = state.longitude, alt = state.altitude;
+  float    clat, clon, calt;
+  gstart_t in = {.rtc = rtcSource, .age = StateAge(), .hotage = config.seedage, .moved = -1};
+  in.state    = lat != 0 && lon != 0;
+  in.cell     = CellSeed(&clat, &clon, &calt);
+  if (in.state && in.cell) in.moved = GSTART_Distance(lat, lon, clat, clon);
+
+  int start = GSTART_Choose(&in);
+  if (start == GSTART_WARM && in.cell) { // the cell is more likely where we are now
+    lat = clat;
+    lon = clon;
+    alt = calt;
+  }
+  Output("GPS %s start, last fix %ds old %dkm away, rtc %d", GSTART_Name(start), in.age, in.moved, in.rtc);
+  GSTART_Started(start);
+
+  // Try fast start from a seed position if we know one
+  if (start != GSTART_COLD) {
+    updateScreen(start == GSTART_HOT ? "GPS hot start" : "GPS warm start");
 
     RTC_Time_t now;
     TIME_GetRtcTime(&now);
@@ -1093,13 +1773,13 @@ void InitialiseGPS() {
     // test this behaviour, also check rtc date is vaguely sane first
 #ifdef GPS_AGPSFIX
     Output("Set AGPS");
-    if (GPS_AGPS(state.latitude, state.longitude, state.altitude, true)) { Output("Got AGPS"); }
+    if (GPS_AGPS(lat, lon, alt, true)) { Output("Got AGPS"); }
 #endif
 #ifdef GPS_FASTFIX
     Output("Fast start RTC: %d/%d/%d %02d:%02d:%02d", now.year, now.month, now.day, now.hour, now.minute, now.second);
 
     for (retries = 0; retries < 5; ++retries) {
-      ret = GPS_SetLocationTime(state.latitude, state.longitude, state.altitude, &now);
+      ret = GPS_SetLocationTime(lat, lon, alt, &now);
       if (ret) break;
       OS_Sleep(1000);
     }
@@ -1153,19 +1833,296 @@ fail:
   // then reboot? or does it automatically?
 }
 
+/*
+ * gprs task periodic jobs, run from the scheduler
+ */
+int      uploadJob   = -1;
+int      uploadFails = 0; // in a row, for backoff
+uint32_t lastUpload  = 0; // ms, everything sent
+bool     holding     = false;
+
+// From the main task, the link is usable again so drop any backoff and send what's waiting in one go
+void LinkBack(const char* why) {
+  if (!uploadFails && !holding) return;
+  Output("Link back (%s), uploading", why);
+  uploadFails = 0;
+  SCHED_Poke(uploadJob, 0);
+}
+
+/*
+ * Live mode, one connection held open and fixes sent as HandleGps makes
+ * them. When it drops they go to the SD cache for the upload job.
+ */
+int      livefd     = -1;
+bool     livev2     = false;
+int      liveFails  = 0; // in a row, for backoff
+uint32_t liveRetry  = 0; // ms, no reconnect before
+uint32_t livePolled = 0; // ms, last asked the server for commands
+
+void LiveClose() {
+  if (livefd >= 0) close(livefd);
+  livefd = -1;
+}
+
+// Anything to read on an idle live connection means the server closed it
+bool LiveUp() {
+  struct timeval tv = {0};
+  fd_set         rd;
+  char           c;
+
+  FD_ZERO(&rd);
+  FD_SET(livefd, &rd);
+  return select(livefd + 1, &rd, NULL, NULL, &tv) == 0 || recv(livefd, &c, 1, MSG_PEEK) > 0;
+}
+
+bool LiveConnect() {
+  struct sockaddr_in sockaddr;
+  ServerAddr(&sockaddr);
+
+  livefd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (livefd < 0) return false;
+  if (connect(livefd, (struct sockaddr*)&sockaddr, sizeof(struct sockaddr_in)) < 0) {
+    Output("Live connect fail ip:%s, port:%d", ServerIp(), config.port);
+    LiveClose();
+    return false;
+  }
+  livev2 = config.protocol == 2 && v2misses < 3 && V2Hello(livefd);
+  Output("Live connection up, %s", livev2 ? "v2" : "v1");
+  return true;
+}
+
+void LiveJob() {
+  SCHED_Stop(liveJob); // until the next fix pokes it
+  livePending = false; // after the stop, so a poke from here on isn't cancelled
+  if (!config.live) {
+    LiveClose();
+    return;
+  }
+  if (!strlen(sdbuffer) || (livefd < 0 && (int32_t)(liveRetry - EVS_Now()) > 0)) return; // gathers until the retry
+  int   logged;
+  char* copy = TakeBuffer(&logged);
+  if (!copy) return;
+  int len = strlen(copy);
+
+  if (livefd >= 0 && !LiveUp()) LiveClose();
+  SaveToSDLog(copy + logged); // the log has it whether or not it goes
+  LED_data(true);
+  bool ret = (livefd >= 0 || LiveConnect()) && (livev2 ? V2Upload(livefd, copy, len) : V1Upload(livefd, copy, len));
+  if (ret && livev2 && v2commands && EVS_Now() - livePolled >= config.upload * 1000) { // not on every fix
+    V2Commands(livefd);
+    livePolled = EVS_Now();
+  }
+  LED_data(false);
+
+  if (ret) {
+    POOL_Free(copy);
+    liveFails  = 0;
+    lastUpload = EVS_Now();
+    return;
+  }
+  LiveClose();
+  if (!StoreCache(copy)) Output("Unable to cache, discarded"); // unsent lines, uploaded when the link's back
+  POOL_Free(copy);
+  uint32_t wait = LINKQ_Backoff(++liveFails);
+  liveRetry     = EVS_Now() + wait;
+  Output("Live send failed, cached, retry in %ds", wait / 1000);
+}
+
+/*
+ * SD cache backfill. Fixes cached through a gap go up oldest first, a
+ * slice per upload after the newest, with the offset sent so far kept
+ * beside the cache so a restart carries on. Losing the offset only means
+ * some are sent again.
+ */
+#define BACKFILL     2048      // bytes of cache per upload, ~25 fixes
+#define BACKFILL_GAP 15 * 1000 // ms between uploads while there's a backlog
+
+uint32_t backfillPos = 0; // bytes of /t/cache sent
+
+// Send the next slice of the cache, false if it didn't go, more if some is left after it
+bool Backfill(bool* more) {
+  // A new cache starts at 0, and an offset written as the old one was cleared goes with it
+  if (cacheCleared) {
+    cacheCleared = false;
+    backfillPos  = 0;
+    SDW_Remove(backfillFile, -1);
+  }
+  SDW_Flush(cacheFile);
+  int64_t size = SDW_Size(cacheFile);
+  if (size <= 0) {
+    dsk_on = false;
+    return true;
+  }
+  if (backfillPos > size) backfillPos = 0; // not this cache's
+
+  bool ret = true;
+  if (backfillPos < size) {
+    int32_t fc    = API_FS_Open("/t/cache", FS_O_RDONLY, 0);
+    char*   slice = POOL_Alloc(BACKFILL + 1);
+    if (fc < 0 || !slice) {
+      if (fc >= 0) API_FS_Close(fc);
+      POOL_Free(slice);
+      return false;
+    }
+    API_FS_Seek(fc, backfillPos, FS_SEEK_SET);
+    int32_t n = API_FS_Read(fc, (uint8_t*)slice, BACKFILL);
+    API_FS_Close(fc);
+
+    int32_t used = n;
+    while (used > 0 && slice[used - 1] != '\n') used--; // whole lines, the rest next time
+    if (!used) used = n;
+    if (used > 0) {
+      if (!SDW_Unframe(slice, used) || UploadToServer(slice)) { // trailers stay on the card
+        if (!cacheCleared) {                                        // unless ClearSD ran meanwhile
+          backfillPos += used;
+          SDW_Write(backfillFile, &backfillPos, sizeof(backfillPos));
+          Output("Backfilled %d of %d cached bytes", backfillPos, (int32_t)size);
+        }
+      } else
+        ret = false;
+    }
+    POOL_Free(slice);
+  }
+
+  if (ret && !cacheCleared && backfillPos >= size) {
+    if (SDW_Remove(cacheFile, size)) { // Only delete if all done and nothing added
+      SDW_Remove(backfillFile, -1);
+      backfillPos = 0;
+      dsk_on      = false;
+    }
+  }
+  *more = dsk_on;
+  return ret;
+}
+
+// Upload the RAM buffer then backfill from the SD cache
+void UploadJob() {
+  bool    ret    = true;
+  bool    more   = false; // backlog left on SD
+  char*   reason = "";
+  uint8_t status;
+
+  // Transmitting in a weak signal costs a lot of power, hold off unless data's getting old
+  if (LINKQ_Poor() && EVS_Now() - lastUpload < config.maxstale * 1000) {
+    if (!holding) {
+      Output("Signal poor, holding upload");
+      strcpy(stateMsg, "Weak signal");
+      refreshScreen();
+      holding = true;
+    }
+    SCHED_Set(uploadJob, 30 * 1000); // then everything goes in one burst
+    return;
+  }
+  holding = false;
+
+  if (gps_on && dat_on && mob_on) strcpy(stateMsg, "OK.");
+
+  // Do we need a GPRS check/restart?
+  Network_GetActiveStatus(&status); // Is this reliable?
+  if (mob_on && status) { // Registered and activated
+    // Newest first, so the server's current position catches up in one round trip
+    // unless live is sending it already
+    int   logged;
+    char* copy;
+    if (strlen(sdbuffer) && livefd < 0 && (copy = TakeBuffer(&logged))) {
+#ifdef VERBOSE
+      Output("Uploading RAM");
+#endif
+      SaveToSDLog(copy + logged); // add to logfile
+      ret = UploadToServer(copy);
+      if (!ret) {
+        reason = "upload";
+        Output("Unable to upload from RAM");
+      } else
+        copy[0] = 0;      // all gone
+      ReturnBuffer(copy); // unsent lines go back in front of new fixes
+    }
+
+    // then a slice of any SD cache from a gap, oldest first
+    if (ret && dsk_on && !Backfill(&more)) {
+      reason = "upload";
+      ret    = false;
+    }
+  } else {
+    reason = "register";
+    ret    = false; // force retry
+  }
+
+  // investigate deregister/register
+  if (!ret) // Back off and retry
+  {
+    uint32_t wait = LINKQ_Backoff(++uploadFails);
+    Output("failed, retry in %ds", wait / 1000);
+    sprintf(stateMsg, "Fail retry\n(%s)", reason);
+    refreshScreen();
+    SCHED_Set(uploadJob, wait);
+  } else {
+    uploadFails = 0;
+    lastUpload  = EVS_Now();
+    strcpy(stateMsg, MSG_RUN);
+    refreshScreen();
+#ifdef VERBOSE
+    Output("Next upload in %dm", config.upload / 60);
+#endif
+    SCHED_Set(uploadJob, more && BACKFILL_GAP < config.upload * 1000 ? BACKFILL_GAP : config.upload * 1000);
+  }
+}
+
+// Looks like GPS boot needs to be on main thread not sure why.
+// If the GPS isn't getting anywhere try rebooting it?
+// what's a sane time to wait to fix? 4/5min?
+void GpsCheckJob() {
+  Network_GetCellInfoRequst(); // keep track of the serving cell
+
+  if (nofixcount <= GSTART_Patience() / NMEA_INTERVAL) return;
+
+  SCHED_Fast();
+  OLED_on();
+  sprintf(stateMsg, "Reboot GPS...");
+  Output(stateMsg);
+  refreshScreen();
+
+  // No fix since the last start, the seed was probably wrong so start over without
+  if (GSTART_Reboot() == GSTART_COLD) {
+    Output("No fix since start, COLD GPS reboot");
+    GPS_Reboot(GPS_REBOOT_MODE_COLD);
+    InitialiseGPS(); // Is re-initialise needed?
+  }
+  // else just stick to a warm reset.
+  else {
+    Output("Previous fixed, WARM GPS reboot");
+    GPS_Reboot(GPS_REBOOT_MODE_WARM); // check if we need reinitialise now?
+    GSTART_Started(GSTART_WARM);
+  }
+  nofixcount = 0; // full patience for the new start
+}
+
+void BatteryJob() { battery_mv = PM_Voltage(&battery_pc); }
+
+// Compress rolled logs a frame at a time while there are any
+void LogZipJob() {
+  char msg[80];
+  if (LOGZ_Step(msg, sizeof(msg))) Output("%s", msg);
+  if (LOGZ_Busy()) SCHED_Set(logzipJob, 1000);
+  else
+    SCHED_Stop(logzipJob);
+}
+
 /*
  * Initialise data connection and start uploading
  */
 void gprs_Task(void* pData) {
+  MEMSTAT_Paint(MEMSTAT_GPRS, GPS_TASK_STACK_SIZE);
   LED_Blink(pData); // Set the LED timer going, 1sec blink to start
+  BatteryJob();
 
   strcpy(stateMsg, "Wait for init");
   refreshScreen();
 
-  uint8_t status;
   while (!initialised) OS_Sleep(1000);
 
   ImeiRead(); // Populate global imei
+  LINKQ_Seed((const char*)imei, udpboot ^ EVS_Now());
 
   // 60 seconds might be too quick, try 3 min?
   // If we can't get GPRS in this time, start over
@@ -1184,7 +2141,8 @@ void gprs_Task(void* pData) {
   RTC_Time_t time;
   if (!nettime) {
     if (GetNTP(&time)) {
-      nettime = true;
+      nettime   = true;
+      rtcSource = GSTART_RTC_NTP;
       Output("NTP time synchronised.");
     }
   }
@@ -1211,9 +2169,8 @@ void gprs_Task(void* pData) {
   strcpy(stateMsg, MSG_RUN); // TODO Consolidate the display messages.
   refreshScreen();
 
-  // Activate screen timeout
-  OS_StartCallbackTimer(mainTaskHandle, 1000 * config.screentime, OLED_off,
-                        NULL); // Will this work?
+  // Only look up now if there's nothing cached
+  if (!ServerIp()[0] && DNSC_Resolve(config.server)) Output("Resolved %s to %s", config.server, DNSC_Address());
 
   char msg[64];
   sprintf(msg, "*IVR:%s#", imei);
@@ -1226,118 +2183,19 @@ void gprs_Task(void* pData) {
   //        storageInfo.total);
   // SMS_ListMessageRequst(SMS_STATUS_ALL, SMS_STORE); // Read and delete?
 
-  bool ret = true;
-  char reason[16]; // TODO cleanup.
-  while (1) {
-    if (gps_on && dat_on && mob_on) strcpy(stateMsg, "OK.");
-
-#if 1 // do we want this?
-      // Looks like GPS boot needs to be on main thread not sure why.
-      // If the GPS isn't getting anywhere try rebooting it?
-      // what's a sane time to wait to fix? 4/5min?
-    if (nofixcount > (10 * 60 / NMEA_INTERVAL)) {
-      OLED_on();
-      sprintf(stateMsg, "Reboot GPS...");
-      Output(stateMsg);
-      refreshScreen();
-
-      // If we never locked, assume moved too far and full cold start
-      if (fixcount == 0) {
-        Output("Never fix, COLD GPS reboot");
-        state.latitude  = 0; // Start from scratch
-        state.longitude = 0;
-        GPS_Reboot(GPS_REBOOT_MODE_COLD);
-        InitialiseGPS(); // Is re-initialise needed?
-      }
-      // else just stick to a warm reset.
-      else {
-        Output("Previous fixed, WARM GPS reboot");
-        GPS_Reboot(GPS_REBOOT_MODE_WARM); // check if we need reinitialise now?
-      }
-    }
-#endif
-
-    // Do we need a GPRS check/restart?
-    Network_GetActiveStatus(&status); // Is this reliable?
-    if (mob_on && status) {           // Registered and activated
-      // Have connection, so do uploading.
-      // are we reconnecting with an SD cache?
-      // flush that first
-      int32_t fc = API_FS_Open("/t/cache", FS_O_RDONLY, 0);
-      if (fc > 0) {
-#ifdef VERBOSE
-        Output("Uploading cached");
-#endif
-        int64_t  cachelen = API_FS_GetFileSize(fc);
-        uint8_t* cache    = OS_Malloc(cachelen + 1);
-        if (cache) {
-          int32_t lenread = API_FS_Read(fc, (uint8_t*)cache, cachelen);
-          cache[lenread]  = 0;
-          API_FS_Close(fc);
-          if (lenread) {
-            if (UploadToServer(cache)) {
-              API_FS_Delete("/t/cache"); // Only delete if all done
-              dsk_on = false;
-            } else { // we'll end up resending some
-            }
-          }
-          OS_Free(cache);
-        }
-      }
+  ScreenTimeout();
 
-      // now upload our memory buffer (~10mins size)
-      // if we uploaded the SD cache
-      if (!dsk_on && strlen(sdbuffer)) {
-#ifdef VERBOSE
-        Output("Uploading RAM");
-#endif
-        ret = UploadToServer(sdbuffer);
-        if (!ret) {
-          strcpy(reason, "upload");
-          Output("Unable to upload from RAM");
-        } else {
-          if (SaveToSDLog(sdbuffer)) // add to logfile
-            sdbuffer[0] = 0;         // Truncate
-        }
-      }
-    } else {
-      strcpy(reason, "register");
-      ret = false; // force 1min retry
-    }
-
-    // investigate deregister/register
-    if (!ret) // Check and retry upload again every minute.
-    {
-      Output("failed, retry in 1min");
-      sprintf(stateMsg, "Fail retry\n(%s)", reason);
-      refreshScreen();
-
-      for (int pause = 60; pause > 0; pause--) {
-        WatchDog_KeepAlive();
-        OS_Sleep(1000); // retry each minute
-      }
-      ret = true;
-    } else {
-      strcpy(stateMsg, MSG_RUN);
-      refreshScreen();
+  if (!config.server_ip[0]) dnsJob = SCHED_Add("dns", DnsJob, 0, 0);
+  uploadJob = SCHED_Add("upload", UploadJob, 0, 0);
+  SCHED_Add("watchdog", WatchDog_KeepAlive, 30 * 1000, SCHED_LIGHT);
+  SCHED_Add("battery", BatteryJob, 60 * 1000, SCHED_LIGHT);
+  SCHED_Add("gpscheck", GpsCheckJob, NMEA_INTERVAL * 6 * 1000, SCHED_LIGHT);
+  SCHED_Add("memstat", MEMSTAT_Sample, 5 * 60 * 1000, SCHED_LIGHT);
+  SCHED_Add("sdwrite", SDW_Tick, 15 * 1000, SCHED_LIGHT);
+  logzipJob = SCHED_Add("logzip", LogZipJob, 0, SCHED_LIGHT);
+  liveJob   = SCHED_Add("live", LiveJob, 0, 0);
 
-      // slow down, chill and wait. seems to cause chaos. :(
-      // Changing speed seems to cause issues
-      PM_SetSysMinFreq(PM_SYS_FREQ_32K);
-#ifdef VERBOSE
-      Output("Sleep (slow) for %dm", config.upload / 60);
-#endif
-      for (int pause = config.upload; pause > 0; pause--) {
-        WatchDog_KeepAlive();
-        OS_Sleep(1000); // check max sleep for 5min upload
-      }
-#ifdef VERBOSE
-      Output("Wakeup (fast)");
-#endif
-      PM_SetSysMinFreq(PM_SYS_FREQ_178M);
-      OS_Sleep(1000); // short pause seems necessary if freq changed
-    }
-  }
+  SCHED_Run();
 }
 
 void SMSInit() {
@@ -1402,24 +2260,52 @@ void InitConfig() {
     OS_Sleep(10000);
     PowerOff(); // Bye bye
   }
+  if (oldServerIp) {
+    Output("Dropped serverip from config, server address now cached");
+    WriteConfig();
+  }
   if (config.loglevel & DEBUG) CreateLog(); // Empty logfile
 
+  logFile      = SDW_Open(GPS_LOG_FILE_PATH, SDW_APPEND, 10 * 60 * 1000); // already uploaded, can wait
+  cacheFile    = SDW_Open("/t/cache", SDW_APPEND, 60 * 1000);           // unsent
+  stateFile    = SDW_Open("/t/state", SDW_REPLACE, 2 * 60 * 1000);
+  backfillFile = SDW_Open("/t/cache.pos", SDW_REPLACE, 60 * 1000);      // resent if lost
+
+  // Cut back anything torn by power loss last time
+  int files[] = {logFile, cacheFile};
+  for (int i = 0; i < 2; i++) {
+    int32_t cut = SDW_Recover(files[i]);
+    if (cut > 0) Output("Recovered %s, cut %d torn bytes", i ? "/t/cache" : GPS_LOG_FILE_PATH, cut);
+    else if (cut < 0)
+      Output("No good record at end of %s", i ? "/t/cache" : GPS_LOG_FILE_PATH);
+  }
+  TRK_Load(GPS_LOG_FILE_PATH); // time index for the current log, rolled ones are on SD
+
   // preload last good state.
   // show if we have good state?
-  int32_t fd = API_FS_Open("/t/state", FS_O_RDONLY, 0);
-  if (fd > 0) {
-    API_FS_Read(fd, (uint8_t*)&state, sizeof(state_t));
+  if (SDW_Load(stateFile, &state, sizeof(state_t))) {
     Output("Loaded last state.");
-    API_FS_Close(fd);
   } else {
+    if (FileExists("/t/state")) Output("Last state torn, ignored.");
     memset(&state, 0, sizeof(state_t));
   }
 
   // Show if we have some unsent data?
   if (FileExists("/t/cache")) { dsk_on = true; }
+  if (dsk_on && SDW_Load(backfillFile, &backfillPos, sizeof(backfillPos))) Output("Cache sent to %d", backfillPos);
+
+  if (!config.server_ip[0]) Output("Server %s cached as '%s'", config.server, DNSC_Load(config.server));
+  CountBoot(); // udp sequences start again
+  if (config.protocol == 2 && V2Refused()) {
+    v2misses = 3; // delete /t/v1server to offer again
+    Output("Server %s is v1, not offering v2", config.server);
+  }
+  CELL_Load();
+  GSTART_Load();
 }
 
 void appMainTask(void* pData) {
+  MEMSTAT_Paint(MEMSTAT_MAIN, MAIN_TASK_STACK_SIZE);
   LED_init();
 
   // Twinkle to show alive and ready
@@ -1445,10 +2331,15 @@ void appMainTask(void* pData) {
   OLED_show();
   OS_Sleep(1000);
 
-  UARTInit(); // Logging option
-  SMSInit();  // Listen for SMS messages
+  POOL_Init(); // All our own allocations
+  SDW_Init();  // Buffered SD files
+  XFER_Init(); // UART file export task
+  TW_Init();   // Software timers
+  UARTInit();  // Logging option
+  SMSInit();   // Listen for SMS messages
 
-  sdbuffer = OS_Malloc(BUFFER_SIZE);
+  sdbuffer   = POOL_Alloc(BUFFER_SIZE);
+  bufferLock = OS_CreateMutex();
 
   if (!sdbuffer) {
     Output("Cant create sdbuffer");
@@ -1461,6 +2352,9 @@ void appMainTask(void* pData) {
   Output("GPS Monitor " SOFT_VERSION " running");
   InitConfig(); // Need defaults for handlers to start running
 
+  char memstats[64];
+  if (MEMSTAT_Previous(memstats, sizeof(memstats))) Output("Previous session %s", memstats);
+
   // Does this help power issues?
   if (strcmp(config.apn, "everywhere") == 0) {
     Output("Limit to 1800 & 1900 bands");
@@ -1479,13 +2373,28 @@ void appMainTask(void* pData) {
   OS_CreateTask(gprs_Task, NULL, NULL, GPS_TASK_STACK_SIZE, MAIN_TASK_PRIORITY + 2, 0, 0, "GPRS Task");
 
   // Wait event
+  uint32_t statstime = EVS_Now();
   while (1) {
+    EVS_Wait();
     if (OS_WaitEvent(mainTaskHandle, (void**)&event, OS_TIME_OUT_WAIT_FOREVER)) {
+      EVS_Begin(event->id);
       EventDispatch(event);
+      EVS_End();
       OS_Free(event->pParam1);
       OS_Free(event->pParam2);
       OS_Free(event);
     }
+
+    // Periodic event loop stats to the log
+    if (config.statslog && EVS_Now() - statstime >= config.statslog * 60 * 1000) {
+      char* stats = POOL_Alloc(REPLY_SIZE);
+      if (stats) {
+        EVS_Format(stats, REPLY_SIZE, false);
+        Output("%s", stats);
+        POOL_Free(stats);
+      }
+      statstime = EVS_Now();
+    }
   }
 }
 
@@ -15,5 +15,6 @@
       API_FS_Write(logfile, (uint8_t*)logbuf, strlen(logbuf));                 \
       API_FS_Close(logfile);                                                   \
     }                                                                          \
-    if (config.loglevel & UART) UART_Write(UART1, logbuf, strlen(logbuf));     \
+    if ((config.loglevel & UART) && !XFER_Active())                            \
+      UART_Write(UART1, logbuf, strlen(logbuf)); /* not into a transfer */     \
   } while (0)
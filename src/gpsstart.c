@@ -0,0 +1,136 @@
+/*
+ * GPS start mode choice and time to first fix statistics.
+ *
+ * Hot needs a recent fix, nearby, and a clock from the network or NTP.
+ * Warm seeds a coarse position, the serving cell's if we have one. A
+ * clock that only survived from before the reboot is too uncertain for
+ * hot, and with no plausible clock at all seeding does more harm than
+ * good so it's cold. A seeded start that reboots without ever fixing
+ * goes cold on the next attempt.
+ *
+ * The last GSTART_SAMPLES first fix times per mode are kept on SD. The
+ * no-fix reboot waits twice the 90th percentile for the mode in play,
+ * within limits, falling back to a fixed wait until there are enough
+ * samples.
+ */
+
+#include <api_fs.h>
+#include <api_os.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "evstats.h"
+#include "gpsstart.h"
+
+#define GSTART_FILE     "/t/ttff"
+#define GSTART_SAMPLES  32
+#define GSTART_NEAR     50  // km, further and the last fix is no use for hot
+#define GSTART_FAR      500 // km, further and it's no use for warm either
+#define PATIENCE        600 // s, until there are enough samples
+#define PATIENCE_MIN    300
+#define PATIENCE_MAX    1200
+#define PATIENCE_SAMPLE 5
+
+typedef struct {
+  uint16_t ttff[GSTART_MODES][GSTART_SAMPLES]; // s
+  uint16_t count[GSTART_MODES];                // ever, next slot is count % GSTART_SAMPLES
+} gstart_stats_t;
+
+static gstart_stats_t stats;
+static const char*    names[GSTART_MODES] = {"cold", "warm", "hot"};
+static int            mode                = GSTART_COLD;
+static bool           waiting             = false; // for the first fix
+static bool           noseed              = false; // last seed never fixed
+static uint32_t       started             = 0;
+
+void GSTART_Load() {
+  int32_t fd = API_FS_Open(GSTART_FILE, FS_O_RDONLY, 0);
+  if (fd <= 0) return;
+  if (API_FS_Read(fd, (uint8_t*)&stats, sizeof(stats)) != sizeof(stats)) memset(&stats, 0, sizeof(stats));
+  API_FS_Close(fd);
+}
+
+int GSTART_Choose(gstart_t* in) {
+  bool near = in->moved < 0 || in->moved < GSTART_NEAR;
+  bool far  = in->moved >= GSTART_FAR;
+
+  if (noseed || (in->age < 0 && in->rtc == GSTART_RTC_NONE)) return GSTART_COLD;
+  if (in->state && in->rtc != GSTART_RTC_NONE && in->age >= 0 && in->age < in->hotage && near) return GSTART_HOT;
+  if (in->cell || (in->state && !far)) return GSTART_WARM;
+  return GSTART_COLD;
+}
+
+int GSTART_Reboot() {
+  if (!waiting) return GSTART_WARM;
+  noseed = mode != GSTART_COLD;
+  return GSTART_COLD;
+}
+
+void GSTART_Started(int m) {
+  mode    = m;
+  waiting = true;
+  started = EVS_Now();
+}
+
+int32_t GSTART_Fixed() {
+  noseed = false;
+  if (!waiting) return -1;
+  waiting = false;
+
+  uint32_t s = (EVS_Now() - started) / 1000;
+  stats.ttff[mode][stats.count[mode]++ % GSTART_SAMPLES] = s > 0xffff ? 0xffff : s;
+
+  int32_t fd = API_FS_Open(GSTART_FILE, FS_O_RDWR | FS_O_CREAT | FS_O_TRUNC, 0);
+  if (fd > 0) {
+    API_FS_Write(fd, (uint8_t*)&stats, sizeof(stats));
+    API_FS_Close(fd);
+  }
+  return s;
+}
+
+// pc percentile of a mode's samples, -1 if none
+static int Percentile(int m, int pc) {
+  uint16_t v[GSTART_SAMPLES];
+  int      n = stats.count[m] < GSTART_SAMPLES ? stats.count[m] : GSTART_SAMPLES;
+  if (!n) return -1;
+
+  memcpy(v, stats.ttff[m], n * sizeof(v[0]));
+  for (int i = 1; i < n; i++) { // insertion sort, n is tiny
+    uint16_t x = v[i];
+    int      j = i;
+    for (; j > 0 && v[j - 1] > x; j--) v[j] = v[j - 1];
+    v[j] = x;
+  }
+  return v[(n - 1) * pc / 100];
+}
+
+uint32_t GSTART_Patience() {
+  int m = waiting ? mode : GSTART_HOT; // lost a fix we had, should come back like a hot start
+  if (stats.count[m] < PATIENCE_SAMPLE) return PATIENCE;
+
+  uint32_t p = 2 * Percentile(m, 90);
+  return p < PATIENCE_MIN ? PATIENCE_MIN : p > PATIENCE_MAX ? PATIENCE_MAX : p;
+}
+
+int32_t GSTART_Distance(float lat1, float lon1, float lat2, float lon2) {
+  float x = (lon2 - lon1) * cosf((lat1 + lat2) * (float)M_PI / 360);
+  float y = lat2 - lat1;
+  return sqrtf(x * x + y * y) * 111.2f; // km per degree
+}
+
+const char* GSTART_Name(int m) { return names[m]; }
+
+int GSTART_Format(char* buf, int size, bool verbose) {
+  int n = snprintf(buf, size, "TTFF");
+  for (int m = GSTART_MODES - 1; m >= 0 && n < size; m--) {
+    if (!stats.count[m]) continue;
+    if (verbose)
+      n += snprintf(buf + n, size - n, " %s %u p50 %ds p90 %ds max %ds", names[m], stats.count[m], Percentile(m, 50),
+                    Percentile(m, 90), Percentile(m, 100));
+    else
+      n += snprintf(buf + n, size - n, " %c %d/%d", names[m][0], Percentile(m, 50), Percentile(m, 90));
+  }
+  if (n < size) n += snprintf(buf + n, size - n, ", wait %us", GSTART_Patience());
+  return n;
+}
@@ -0,0 +1,31 @@
+/*
+ * GPS start mode choice and time to first fix statistics
+ */
+
+#define GSTART_COLD  0 // no seed
+#define GSTART_WARM  1 // coarse position and time, ephemeris assumed gone
+#define GSTART_HOT   2 // recent fix and time
+#define GSTART_MODES 3
+
+#define GSTART_RTC_NONE 0 // whatever the RTC kept
+#define GSTART_RTC_NET  1
+#define GSTART_RTC_NTP  2
+
+typedef struct {
+  int     rtc;    // GSTART_RTC_ source
+  int32_t age;    // s since the last fix, -1 if unknown
+  int32_t hotage; // s a fix stays good enough for a hot start
+  bool    state;  // have a last fix
+  bool    cell;   // have a serving cell position
+  int32_t moved;  // km between last fix and cell position, -1 if unknown
+} gstart_t;
+
+void        GSTART_Load();                // boot, restore statistics from SD
+int         GSTART_Choose(gstart_t* in);  // mode for a fresh start
+int         GSTART_Reboot();              // mode for a no-fix reboot
+void        GSTART_Started(int mode);
+int32_t     GSTART_Fixed();               // on each fix, records and returns the first after a start, else -1
+uint32_t    GSTART_Patience();            // s without satellites before a reboot
+int32_t     GSTART_Distance(float lat1, float lon1, float lat2, float lon2); // km
+const char* GSTART_Name(int mode);
+int         GSTART_Format(char* buf, int size, bool verbose);
@@ -0,0 +1,85 @@
+/*
+ * Upload protocol v2 batch coding, plain C so util/ivrserver can share it.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ivrv2.h"
+#include "lzs.h"
+
+// Fields every record repeats, known to both ends
+const char V2_DICT[] = ",A,0.00,no fix#\n,V,2D fix#\n,3D/DGPS fix,3D fix,";
+
+int V2_Pack(const char* imei, const char* text, int len, uint8_t* raw, uint8_t* frame, int framesize, int* used) {
+  char prefix[40];
+  int  plen = snprintf(prefix, sizeof(prefix), "*IVR,%s,", imei);
+  int  r    = 0;
+  int  i    = 0;
+
+  while (i < len) {
+    const char* eol  = (const char*)memchr(text + i, '\n', len - i);
+    int         llen = eol ? eol - (text + i) : len - i;
+    int         skip = (llen > plen && memcmp(text + i, prefix, plen) == 0) ? plen : 0;
+    int         take = llen - skip;
+
+    if (llen == 0) { // blank line
+      i++;
+      continue;
+    }
+    if (r + take + 1 > V2_MAXRAW) {
+      if (r) break;
+      take = V2_MAXRAW - 1; // oversize line, shouldn't happen, sent cut short
+    }
+    memcpy(raw + r, text + i + skip, take);
+    r += take;
+    raw[r++] = '\n';
+    i += llen + (eol ? 1 : 0);
+  }
+  *used = i;
+  if (!r) return 0;
+
+  int      c      = LZS_Compress((const uint8_t*)V2_DICT, sizeof(V2_DICT) - 1, raw, r, frame + V2_HEADER, framesize - V2_HEADER);
+  uint16_t coded  = c < 0 ? r | V2_STORED : c;
+  if (c < 0) {
+    if (r > framesize - V2_HEADER) return -1;
+    memcpy(frame + V2_HEADER, raw, r);
+    c = r;
+  }
+  frame[0] = V2_BATCH;
+  frame[1] = r & 0xff;
+  frame[2] = r >> 8;
+  frame[3] = coded & 0xff;
+  frame[4] = coded >> 8;
+  return V2_HEADER + c;
+}
+
+int V2_Unpack(const char* imei, const uint8_t* frame, int framelen, char* text, int textsize) {
+  uint8_t raw[V2_MAXRAW];
+
+  if (framelen < V2_HEADER || frame[0] != V2_BATCH) return -1;
+  int rawlen = frame[1] | (frame[2] << 8);
+  int coded  = frame[3] | (frame[4] << 8);
+  int len    = coded & ~V2_STORED;
+  if (rawlen > V2_MAXRAW || V2_HEADER + len > framelen) return -1;
+
+  if (coded & V2_STORED) memcpy(raw, frame + V2_HEADER, rawlen);
+  else if (LZS_Decompress((const uint8_t*)V2_DICT, sizeof(V2_DICT) - 1, frame + V2_HEADER, len, raw, sizeof(raw)) != rawlen)
+    return -1;
+
+  // Put the prefix back on each line
+  int t = 0;
+  for (int i = 0; i < rawlen;) {
+    const uint8_t* eol  = (const uint8_t*)memchr(raw + i, '\n', rawlen - i);
+    int            llen = eol ? eol - (raw + i) : rawlen - i;
+    if (raw[i] != '*') t += snprintf(text + t, textsize > t ? textsize - t : 0, "*IVR,%s,", imei);
+    if (t + llen + 1 >= textsize) return -1;
+    memcpy(text + t, raw + i, llen);
+    t += llen;
+    text[t++] = '\n';
+    i += llen + 1;
+  }
+  text[t] = 0;
+  return t;
+}
@@ -0,0 +1,47 @@
+/*
+ * Upload protocol v2, shared with util/ivrserver
+ *
+ * Device sends V2_HELLO<imei>#\n, a v2 server answers V2_ACCEPT and the
+ * rest of the session is batch frames. Anything else and the device
+ * carries on in v1 text on the same connection.
+ *
+ * Frame: V2_BATCH, u16 raw length, u16 coded length (V2_STORED if raw),
+ * little endian, then the batch. Batch is the v1 lines, newline
+ * separated, with the "*IVR,<imei>," prefix dropped, LZS coded against
+ * V2_DICT. Lines that didn't carry the prefix are kept whole.
+ *
+ * A server that can send the device commands answers V2_ACCEPT_CMD to
+ * the hello instead. After its batches the device sends V2_POLL, and the
+ * server sends whatever it has queued for that IMEI, each V2_CMD, u8
+ * length and the command as it would come by SMS, then V2_DONE. The
+ * device answers each command with V2_REPLY, u16 length and the reply
+ * text before reading the next.
+ *
+ * Over UDP each datagram is V2_DGRAM, u16 boot, u16 sequence, IMEI
+ * length, IMEI and one frame. Sequences start again at each boot, and the
+ * boot count tells them apart. The server answers every copy it gets with
+ * V2_ACK, the boot and the sequence, and drops repeats of a boot and
+ * sequence it has seen.
+ */
+
+#define V2_HELLO      "*IVH,2,"
+#define V2_ACCEPT     "*IVH,2#"
+#define V2_ACCEPT_CMD "*IVH,2,C#"
+#define V2_BATCH      'Z'
+#define V2_HEADER     5
+#define V2_MAXRAW     1024
+#define V2_STORED     0x8000
+#define V2_DGRAM      'U'
+#define V2_ACK        'K'
+#define V2_POLL       'P'
+#define V2_CMD        'C'
+#define V2_REPLY      'R'
+#define V2_DONE       'D'
+
+extern const char V2_DICT[];
+
+// Pack whole lines from text into one frame, returns frame size and sets used.
+// Blank lines are skipped, so 0 with used set means there was nothing else left
+int V2_Pack(const char* imei, const char* text, int len, uint8_t* raw, uint8_t* frame, int framesize, int* used);
+// Expand a frame's batch back to v1 lines, returns text length or -1
+int V2_Unpack(const char* imei, const uint8_t* frame, int framelen, char* text, int textsize);
@@ -2,6 +2,7 @@
 #include <api_os.h>
 
 #include "ledutil.h"
+#include "twheel.h"
 
 // Slow 'alive' background blinking
 // Global "current blink state flags"
@@ -9,6 +10,9 @@ int  ledoff   = 1;
 int  ledon    = 1;
 int  leddelay = 1000;
 bool active   = true;
+bool lit      = false;
+
+static tw_timer_t blink;
 
 void LEDActive(bool pause) { active = pause; }
 
@@ -32,18 +36,21 @@ void SetFlash(int off, int on, int delay) {
   leddelay = delay;
 }
 
-void LED_Blink(void* param) {
-  static int count = 0;
-  if (++count == ledoff) {
+// Move to the next blink edge, returns ms until the one after
+static uint32_t LED_Step() {
+  lit = !lit;
+  if (lit) {
     if (active) // Dont flash if we aren't registered
       GPIO_Set(SYSTEM_STATUS_LED, GPIO_LEVEL_HIGH);
-  } else if (count >= ledoff + ledon) {
-    GPIO_Set(SYSTEM_STATUS_LED, GPIO_LEVEL_LOW);
-    count = 0;
+    return ledon * leddelay;
   }
-  OS_StartCallbackTimer(OS_GetUserMainHandle(), leddelay, LED_Blink, NULL);
+  GPIO_Set(SYSTEM_STATUS_LED, GPIO_LEVEL_LOW);
+  return ledoff * leddelay;
 }
 
+// Wake only on blink edges, slack lets them share wakeups with other timers
+void LED_Blink(void* param) { TW_Start(&blink, LED_Step(), 0, 200, LED_Blink, NULL); }
+
 // Twinkle LED, used to highlight fatal issues/states
 void Flash(int time) {
   GPIO_Set(SYSTEM_STATUS_LED, GPIO_LEVEL_HIGH);
@@ -0,0 +1,62 @@
+/*
+ * Radio link quality and upload retry policy.
+ *
+ * Signal reports are smoothed with an exponential average, 1/4 weight
+ * per report, kept in 1/16 units. The link counts as poor below the
+ * SQ/RXQUAL limits and only recovers a couple of steps above them, so a
+ * signal sitting on the edge doesn't flip uploads on and off.
+ *
+ * Failed uploads back off exponentially from a minute up to half an
+ * hour, with +/-25% jitter so a fleet that lost the same cell doesn't
+ * come back in step. The jitter is seeded from the IMEI, so trackers
+ * that booted together still draw different delays.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "linkq.h"
+
+#define SQ_POOR      8   // ~-97dBm
+#define RXQUAL_POOR  6   // bit errors above ~6%
+#define HYSTERESIS   2   // steps of recovery needed
+#define BACKOFF_BASE 60  // s
+#define BACKOFF_MAX  1800
+
+static int  sq     = -1; // x16, -1 until the first report
+static int  rxqual = -1;
+static bool poor   = false;
+
+static int Smooth(int avg, int v) { return avg < 0 ? v * 16 : avg + (v * 16 - avg) / 4; }
+
+void LINKQ_Signal(int s, int q) {
+  if (s != 99) sq = Smooth(sq, s);
+  if (q != 99) rxqual = Smooth(rxqual, q);
+
+  int margin = poor ? HYSTERESIS * 16 : 0;
+  poor       = (sq >= 0 && sq < SQ_POOR * 16 + margin) || (rxqual >= RXQUAL_POOR * 16 - margin);
+}
+
+bool LINKQ_Poor() { return poor; }
+
+uint32_t LINKQ_Backoff(int failures) {
+  uint32_t s = BACKOFF_BASE;
+  while (--failures > 0 && s < BACKOFF_MAX) s *= 2;
+  if (s > BACKOFF_MAX) s = BACKOFF_MAX;
+  s = s * 3 / 4 + rand() % (s / 2 + 1);
+  return s * 1000;
+}
+
+void LINKQ_Seed(const char* id, uint32_t salt) {
+  uint32_t h = 2166136261u; // FNV-1a
+  while (*id) h = (h ^ (uint8_t)*id++) * 16777619u;
+  srand(h ^ salt);
+}
+
+int LINKQ_Format(char* buf, int size) {
+  if (sq < 0) return snprintf(buf, size, "SQ unknown");
+  return snprintf(buf, size, "SQ %d.%d RXQ %d.%d%s", sq / 16, sq % 16 * 10 / 16, rxqual < 0 ? 0 : rxqual / 16,
+                  rxqual < 0 ? 0 : rxqual % 16 * 10 / 16, poor ? " poor" : "");
+}
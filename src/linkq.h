@@ -0,0 +1,9 @@
+/*
+ * Radio link quality and upload retry policy
+ */
+
+void     LINKQ_Signal(int sq, int rxqual);          // from API_EVENT_ID_SIGNAL_QUALITY
+bool     LINKQ_Poor();                              // smoothed signal too weak to upload cheaply
+uint32_t LINKQ_Backoff(int failures);               // ms until retry, after failures in a row
+void     LINKQ_Seed(const char* id, uint32_t salt); // once at boot, so each device jitters differently
+int      LINKQ_Format(char* buf, int size);
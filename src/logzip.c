@@ -0,0 +1,128 @@
+/*
+ * Background compression of rolled GPS logs.
+ *
+ * gps-YYYYMMDD-HHMMSS.log becomes gps-YYYYMMDD-HHMMSS.lz: the magic, then
+ * frames of a little endian u16 raw length, u16 coded length (LOGZ_STORED
+ * set if kept raw) and u32 CRC32 of the raw data, followed by the data.
+ * Frames are coded independently so work is done one frame per step and
+ * a reader can skip through by headers alone. Output goes to a .lzt file
+ * renamed on completion, so a reboot part way just starts that log again.
+ */
+
+#include <api_fs.h>
+#include <api_os.h>
+#include <stdlib.h>
+
+#include "crc32.h"
+#include "logzip.h"
+#include "lzs.h"
+#include "mempool.h"
+
+static int32_t  src  = -1;
+static int32_t  dst  = -1;
+static bool     scan = true; // look for work, set at boot and on roll
+static char     name[48];    // current log, no extension
+static uint32_t rawtotal;
+static uint32_t ziptotal;
+
+void LOGZ_Rolled() { scan = true; }
+
+bool LOGZ_Busy() { return scan || src >= 0; }
+
+// Find a rolled, not yet compressed log
+static bool Next() {
+  Dir_t* dir = API_FS_OpenDir("/t");
+  if (!dir || dir->fs_index < 0) return false;
+
+  bool      found  = false;
+  Dirent_t* dirent = NULL;
+  while (!found && (dirent = API_FS_ReadDir(dir))) {
+    int len = strlen(dirent->d_name);
+    if (strncmp(dirent->d_name, "gps-", 4) || len < 8 || len >= sizeof(name) - 8) continue;
+    if (strcmp(dirent->d_name + len - 4, ".log") || strcmp(dirent->d_name, "gps-current.log") == 0) continue;
+    snprintf(name, sizeof(name), "/t/%.*s", len - 4, dirent->d_name);
+    found = true;
+  }
+  API_FS_CloseDir(dir);
+  return found;
+}
+
+static void Close() {
+  API_FS_Close(src);
+  API_FS_Close(dst);
+  src = dst = -1;
+}
+
+static bool Open() {
+  char path[64];
+
+  snprintf(path, sizeof(path), "%s.log", name);
+  src = API_FS_Open(path, FS_O_RDONLY, 0);
+  snprintf(path, sizeof(path), "%s.lzt", name);
+  dst = API_FS_Open(path, FS_O_RDWR | FS_O_CREAT | FS_O_TRUNC, 0);
+  if (src < 0 || dst < 0 || API_FS_Write(dst, (uint8_t*)LOGZ_MAGIC, 4) != 4) {
+    Close();
+    return false;
+  }
+  rawtotal = 0;
+  ziptotal = 4;
+  return true;
+}
+
+// Compressed copy complete, swap it in for the log
+static void Finish() {
+  char log[64];
+  char lz[64];
+  char tmp[64];
+
+  Close();
+  snprintf(log, sizeof(log), "%s.log", name);
+  snprintf(lz, sizeof(lz), "%s.lz", name);
+  snprintf(tmp, sizeof(tmp), "%s.lzt", name);
+  API_FS_Delete(lz);
+  if (API_FS_Rename(tmp, lz) == 0) API_FS_Delete(log);
+}
+
+bool LOGZ_Step(char* msg, int size) {
+  if (src < 0) {
+    if (!scan) return false;
+    if (!Next() || !Open()) {
+      scan = false; // idle until the next roll
+      return false;
+    }
+  }
+
+  bool     done = false;
+  uint8_t* in   = POOL_Alloc(LOGZ_FRAME);
+  uint8_t* out  = POOL_Alloc(LOGZ_FRAME);
+  if (!in || !out) goto cleanup;
+
+  int32_t n = API_FS_Read(src, in, LOGZ_FRAME);
+  if (n > 0) {
+    int      c      = LZS_Compress(NULL, 0, in, n, out, LOGZ_FRAME);
+    bool     stored = c < 0; // incompressible, keep raw
+    uint16_t coded  = stored ? n | LOGZ_STORED : c;
+    uint32_t crc    = CRC32(0, in, n);
+    uint8_t  hdr[8] = {n & 0xff, n >> 8, coded & 0xff, coded >> 8, crc & 0xff, (crc >> 8) & 0xff, (crc >> 16) & 0xff, crc >> 24};
+
+    if (stored) c = n;
+    if (API_FS_Write(dst, hdr, sizeof(hdr)) != sizeof(hdr) || API_FS_Write(dst, stored ? in : out, c) != c) {
+      Close(); // SD trouble, leave it until the next roll
+      scan = false;
+      goto cleanup;
+    }
+    rawtotal += n;
+    ziptotal += sizeof(hdr) + c;
+  }
+
+  if (n < LOGZ_FRAME) {
+    Finish();
+    snprintf(msg, size, "Compressed %s.log %u -> %u bytes", name, rawtotal, ziptotal);
+    done = true;
+  }
+
+cleanup:
+  POOL_Free(in);
+  POOL_Free(out);
+  return done;
+}
@@ -0,0 +1,11 @@
+/*
+ * Background compression of rolled GPS logs
+ */
+
+#define LOGZ_MAGIC  "IVZ1"
+#define LOGZ_FRAME  2048   // raw bytes per frame
+#define LOGZ_STORED 0x8000 // frame length flag, data not compressed
+
+void LOGZ_Rolled();                  // new rolled log to look at
+bool LOGZ_Busy();                    // anything left to do
+bool LOGZ_Step(char* msg, int size); // one frame of work, true and msg when a file completes
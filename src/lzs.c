@@ -0,0 +1,99 @@
+/*
+ * Small window LZSS codec.
+ *
+ * Stream is groups of a flag byte and 8 items, lsb first. Flag clear is a
+ * literal byte, set is a 2 byte match: 12 bit distance - 1 and 4 bit
+ * length - LZS_MIN. Encoder finds matches through a single 3 byte hash
+ * head table with no chains, so RAM is the table plus the caller's
+ * buffers and it runs in linear time.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lzs.h"
+
+#define LZS_MIN       3
+#define LZS_MAX       (LZS_MIN + 15)
+#define LZS_HASH_BITS 9
+#define LZS_HASH(p)   ((((p)[0] << 6) ^ ((p)[1] << 3) ^ (p)[2]) & ((1 << LZS_HASH_BITS) - 1))
+
+// Byte at position i of dictionary followed by input
+#define AT(i) ((i) < dictlen ? dict[(i)] : in[(i)-dictlen])
+
+int LZS_Compress(const uint8_t* dict, int dictlen, const uint8_t* in, int inlen, uint8_t* out, int outsize) {
+  int16_t head[1 << LZS_HASH_BITS]; // last position + 1 of each hash, in dict+in space
+  int     o     = 0;
+  int     flags = -1; // index of current flag byte
+  int     item  = 8;
+
+  if (dictlen > LZS_WINDOW) { // only the tail can be reached
+    dict += dictlen - LZS_WINDOW;
+    dictlen = LZS_WINDOW;
+  }
+  memset(head, 0, sizeof(head));
+  for (int i = 0; i + LZS_MIN <= dictlen; i++) {
+    uint8_t h[3] = {AT(i), AT(i + 1), AT(i + 2)};
+    head[LZS_HASH(h)] = i + 1;
+  }
+
+  int end = dictlen + inlen;
+  for (int p = dictlen; p < end;) {
+    if (item == 8) {
+      if (o >= outsize) return -1;
+      flags      = o++;
+      out[flags] = 0;
+      item       = 0;
+    }
+
+    int len = 0, dist = 0;
+    if (p + LZS_MIN <= end) {
+      int h    = LZS_HASH(&in[p - dictlen]);
+      int cand = head[h] - 1;
+      head[h]  = p + 1;
+      if (cand >= 0 && p - cand <= LZS_WINDOW) {
+        int max = end - p < LZS_MAX ? end - p : LZS_MAX;
+        while (len < max && AT(cand + len) == in[p - dictlen + len]) len++;
+        dist = p - cand;
+      }
+    }
+
+    if (len >= LZS_MIN) {
+      if (o + 2 > outsize) return -1;
+      out[flags] |= 1 << item;
+      out[o++] = ((dist - 1) >> 4) & 0xff;
+      out[o++] = (((dist - 1) & 15) << 4) | (len - LZS_MIN);
+      for (int i = 1; i < len; i++) // keep the table warm through the match
+        if (p + i + LZS_MIN <= end) head[LZS_HASH(&in[p + i - dictlen])] = p + i + 1;
+      p += len;
+    } else {
+      if (o >= outsize) return -1;
+      out[o++] = in[p - dictlen];
+      p++;
+    }
+    item++;
+  }
+  return o;
+}
+
+int LZS_Decompress(const uint8_t* dict, int dictlen, const uint8_t* in, int inlen, uint8_t* out, int outsize) {
+  int i = 0, o = 0;
+
+  while (i < inlen) {
+    uint8_t flags = in[i++];
+    for (int item = 0; item < 8 && i < inlen; item++) {
+      if (flags & (1 << item)) {
+        if (i + 2 > inlen) return -1;
+        int dist = ((in[i] << 4) | (in[i + 1] >> 4)) + 1;
+        int len  = (in[i + 1] & 15) + LZS_MIN;
+        i += 2;
+        if (dist > o + dictlen || o + len > outsize) return -1;
+        for (int k = 0; k < len; k++, o++) out[o] = o - dist >= 0 ? out[o - dist] : dict[dictlen + o - dist];
+      } else {
+        if (o >= outsize) return -1;
+        out[o++] = in[i++];
+      }
+    }
+  }
+  return o;
+}
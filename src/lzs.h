@@ -0,0 +1,15 @@
+/*
+ * Small window LZSS codec, plain C so util/ tools can share it.
+ *
+ * Each block is coded on its own, optionally against a preset dictionary
+ * the other end also knows. Matches may reach back LZS_WINDOW bytes into
+ * the block and dictionary. Block plus dictionary must stay under 32K.
+ */
+
+#define LZS_WINDOW   4096
+#define LZS_BOUND(n) ((n) + (n) / 8 + 2) // worst case output
+
+// Returns bytes written to out, or -1 if outsize too small
+int LZS_Compress(const uint8_t* dict, int dictlen, const uint8_t* in, int inlen, uint8_t* out, int outsize);
+// Returns bytes written to out, or -1 if corrupt or outsize too small
+int LZS_Decompress(const uint8_t* dict, int dictlen, const uint8_t* in, int inlen, uint8_t* out, int outsize);
@@ -0,0 +1,112 @@
+/*
+ * Size class block allocator.
+ * Each class is a run of equal blocks carved from one static arena at boot,
+ * so long running alloc/free of varying sizes can't fragment it. Alloc and
+ * free are O(1) free list operations. Requests too big for any class, or
+ * made while their classes are exhausted, go to the OS heap.
+ */
+
+#include <api_os.h>
+#include <stdlib.h>
+
+#include "mempool.h"
+
+typedef struct {
+  uint32_t size;  // block size
+  uint16_t count; // blocks in class
+  uint16_t used;  // currently allocated
+  uint16_t high;  // high water
+  uint16_t fails; // requests that found the class exhausted
+  uint8_t* base;  // first block in arena
+  void*    free;  // next pointer kept in the free block itself
+} pool_class_t;
+
+// size, count. Sized for config text, command replies, sdbuffer and scratch reads
+#define POOL_CLASS_LIST \
+  CLASS(64, 8)          \
+  CLASS(256, 8)         \
+  CLASS(512, 4)         \
+  CLASS(1024, 4)        \
+  CLASS(2048, 2)
+
+#define CLASS(s, n) {.size = s, .count = n},
+static pool_class_t classes[] = {POOL_CLASS_LIST};
+#undef CLASS
+#define CLASS(s, n) +(s) * (n)
+#define POOL_ARENA (0 POOL_CLASS_LIST)
+
+#define POOL_CLASSES (sizeof(classes) / sizeof(classes[0]))
+
+static uint8_t  arena[POOL_ARENA] __attribute__((aligned(8)));
+static uint32_t heapallocs = 0; // fallbacks to OS heap
+static uint32_t heapfails  = 0;
+static HANDLE   lock       = NULL;
+
+void POOL_Init() {
+  uint8_t* p = arena;
+
+  lock = OS_CreateMutex();
+  for (int c = 0; c < POOL_CLASSES; c++) {
+    classes[c].base = p;
+    classes[c].free = NULL;
+    for (int i = classes[c].count - 1; i >= 0; --i) {
+      uint8_t* block  = p + i * classes[c].size;
+      *(void**)block  = classes[c].free;
+      classes[c].free = block;
+    }
+    p += classes[c].count * classes[c].size;
+  }
+}
+
+void* POOL_Alloc(uint32_t size) {
+  void* block = NULL;
+
+  OS_LockMutex(lock);
+  for (int c = 0; c < POOL_CLASSES && !block; c++) {
+    if (classes[c].size < size) continue;
+    block = classes[c].free;
+    if (block) {
+      classes[c].free = *(void**)block;
+      if (++classes[c].used > classes[c].high) classes[c].high = classes[c].used;
+    } else
+      classes[c].fails++; // try next class up
+  }
+  OS_UnlockMutex(lock);
+  if (block) return block;
+
+  block = OS_Malloc(size);
+  OS_LockMutex(lock);
+  if (block) heapallocs++;
+  else
+    heapfails++;
+  OS_UnlockMutex(lock);
+  return block;
+}
+
+void POOL_Free(void* block) {
+  uint8_t* p = block;
+  if (!p) return;
+
+  if (p < arena || p >= arena + POOL_ARENA) {
+    OS_Free(block);
+    return;
+  }
+
+  OS_LockMutex(lock);
+  int c = POOL_CLASSES - 1;
+  while (p < classes[c].base) c--;
+  *(void**)block  = classes[c].free;
+  classes[c].free = block;
+  classes[c].used--;
+  OS_UnlockMutex(lock);
+}
+
+// size:high/count!fails per class, then heap fallbacks
+int POOL_Format(char* buf, int size) {
+  int n = snprintf(buf, size, "pool");
+  for (int c = 0; c < POOL_CLASSES && n < size; c++)
+    n += snprintf(buf + n, size - n, " %u:%u/%u!%u", classes[c].size, classes[c].high, classes[c].count, classes[c].fails);
+  if (n < size) n += snprintf(buf + n, size - n, " heap %u!%u", heapallocs, heapfails);
+  if (n >= size) n = size - 1;
+  return n;
+}
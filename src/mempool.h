@@ -0,0 +1,8 @@
+/*
+ * Size class block allocator, falls back to the OS heap
+ */
+
+void  POOL_Init();
+void* POOL_Alloc(uint32_t size); // NULL only if the OS heap also fails
+void  POOL_Free(void* block);
+int   POOL_Format(char* buf, int size);
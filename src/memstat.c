@@ -0,0 +1,111 @@
+/*
+ * Task stack and heap high water tracking.
+ *
+ * The SDK doesn't expose task stacks, so each task paints part of its own
+ * stack on entry, assuming it grows down from just above the entry frame.
+ * OS_CreateTask's nStackSize (UINT16 in api_os.h) has no stated unit; it's
+ * taken as bytes, the smaller reading, and the last quarter is left
+ * unpainted, so a wrong guess about the entry frame can't take the paint
+ * past the end. Sampling counts how much paint is still intact from the
+ * far end; all of it gone reads as the whole stack used. Heap free and largest allocatable block are tracked at each
+ * sample, and the session figures are saved to SD so the next boot can
+ * report them. The block probe stops at HEAP_PROBE_MAX, so it never holds
+ * more than that while the other tasks may be allocating.
+ */
+
+#include <api_fs.h>
+#include <api_os.h>
+#include <stdlib.h>
+
+#include "memstat.h"
+
+#define MEMSTAT_FILE    "/t/memstat"
+#define STACK_PAINT     0x5a5aa5a5
+#define STACK_RESERVE   512         // allowance for frames above us at paint time
+#define STACK_GUARD(s)  ((s) / 4)   // far end left unpainted
+#define HEAP_PROBE_STEP 1024        // largest block resolution
+#define HEAP_PROBE_MAX  (16 * 1024) // enough for any firmware buffer, reported as the largest
+
+typedef struct {
+  uint32_t stacksize[MEMSTAT_TASKS];
+  uint32_t stackhigh[MEMSTAT_TASKS]; // max used bytes
+  uint32_t heapmin;                  // min free bytes
+  uint32_t blockmin;                 // min largest block
+  uint32_t samples;
+} memstat_t;
+
+static memstat_t stats = {.heapmin = 0xffffffff, .blockmin = 0xffffffff};
+
+static uint32_t* paintlow[MEMSTAT_TASKS]; // lowest painted word
+static uint32_t  paintlen[MEMSTAT_TASKS]; // painted words
+
+void MEMSTAT_Paint(int task, uint32_t stacksize) {
+  volatile uint32_t here;
+  uint32_t*         top = (uint32_t*)&here - 16; // stay clear of this frame
+
+  if (stacksize < 2 * STACK_RESERVE + STACK_GUARD(stacksize)) return;
+  uint32_t words        = (stacksize - STACK_RESERVE - STACK_GUARD(stacksize)) / 4;
+  paintlow[task]        = top - words;
+  paintlen[task]        = words;
+  stats.stacksize[task] = stacksize;
+  for (uint32_t i = 0; i < words; i++) paintlow[task][i] = STACK_PAINT;
+}
+
+// Binary search how big a block we can still get, up to limit
+static uint32_t LargestBlock(uint32_t limit) {
+  uint32_t lo = 0, hi = limit / HEAP_PROBE_STEP;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi + 1) / 2;
+    void*    p   = OS_Malloc(mid * HEAP_PROBE_STEP);
+    if (p) {
+      OS_Free(p);
+      lo = mid;
+    } else
+      hi = mid - 1;
+  }
+  return lo * HEAP_PROBE_STEP;
+}
+
+void MEMSTAT_Sample() {
+  for (int t = 0; t < MEMSTAT_TASKS; t++) {
+    if (!paintlen[t]) continue;
+    uint32_t clean = 0;
+    while (clean < paintlen[t] && paintlow[t][clean] == STACK_PAINT) clean++;
+    uint32_t used = clean ? stats.stacksize[t] - STACK_GUARD(stats.stacksize[t]) - clean * 4 : stats.stacksize[t];
+    if (used > stats.stackhigh[t]) stats.stackhigh[t] = used;
+  }
+
+  OS_Heap_Status_t heap;
+  if (OS_GetHeapUsageStatus(&heap)) {
+    uint32_t avail = heap.totalSize - heap.usedSize;
+    if (avail < stats.heapmin) stats.heapmin = avail;
+    uint32_t block = LargestBlock(avail < HEAP_PROBE_MAX ? avail : HEAP_PROBE_MAX);
+    if (block < stats.blockmin) stats.blockmin = block;
+  }
+  stats.samples++;
+
+  int32_t fd = API_FS_Open(MEMSTAT_FILE, FS_O_RDWR | FS_O_CREAT | FS_O_TRUNC, 0);
+  if (fd > 0) {
+    API_FS_Write(fd, (uint8_t*)&stats, sizeof(stats));
+    API_FS_Close(fd);
+  }
+}
+
+static int Format(memstat_t* s, char* buf, int size) {
+  if (!s->samples) return snprintf(buf, size, "STK/HEAP not sampled");
+  return snprintf(buf, size, "STK %u/%u %u/%u, HEAP %uk blk %uk", s->stackhigh[MEMSTAT_MAIN], s->stacksize[MEMSTAT_MAIN],
+                  s->stackhigh[MEMSTAT_GPRS], s->stacksize[MEMSTAT_GPRS], s->heapmin / 1024, s->blockmin / 1024);
+}
+
+bool MEMSTAT_Previous(char* buf, int size) {
+  memstat_t prev;
+  int32_t   fd = API_FS_Open(MEMSTAT_FILE, FS_O_RDONLY, 0);
+  if (fd <= 0) return false;
+  int32_t len = API_FS_Read(fd, (uint8_t*)&prev, sizeof(prev));
+  API_FS_Close(fd);
+  if (len != sizeof(prev) || !prev.samples) return false;
+  Format(&prev, buf, size);
+  return true;
+}
+
+int MEMSTAT_Format(char* buf, int size) { return Format(&stats, buf, size); }
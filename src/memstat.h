@@ -0,0 +1,12 @@
+/*
+ * Task stack and heap high water tracking
+ */
+
+#define MEMSTAT_MAIN  0
+#define MEMSTAT_GPRS  1
+#define MEMSTAT_TASKS 2
+
+void MEMSTAT_Paint(int task, uint32_t stacksize); // first thing in the task
+void MEMSTAT_Sample();                            // periodic, saves to SD
+bool MEMSTAT_Previous(char* buf, int size);       // last session, call before first sample
+int  MEMSTAT_Format(char* buf, int size);
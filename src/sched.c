@@ -0,0 +1,136 @@
+/*
+ * Deadline scheduler for the gprs task periodic jobs.
+ *
+ * Rather than each job polling on its own timer, every job has a next
+ * deadline and the task sleeps in one wait until the earliest of them.
+ * Jobs due within SCHED_BATCH of a wakeup run in the same batch so the
+ * cpu is woken once. The cpu floor stays at 32K unless a batch has
+ * non-light work, and time at each floor is accounted for reporting.
+ *
+ * Other tasks can pull a job forward with SCHED_Poke, which cuts the
+ * wait short through a semaphore.
+ *
+ * Times are kept in clock() ticks and compared by signed difference so
+ * the tick counter can wrap.
+ */
+
+#include <api_hal_pm.h>
+#include <api_os.h>
+#include <stdlib.h>
+
+#include "sched.h"
+
+#define SCHED_BATCH  2000 // ms, pull forward jobs due this soon
+#define SCHED_SETTLE 1000 // ms, pause after raising freq, seems necessary
+#define TICKS(ms)    ((uint32_t)((ms) * CLOCKS_PER_MSEC))
+#define DUE(t, now)  ((int32_t)((t) - (now)) <= 0)
+
+typedef struct {
+  const char* name;
+  sched_fn_t  fn;
+  uint32_t    period; // ticks, 0 if job reschedules itself
+  uint32_t    next;   // ticks
+  uint8_t     flags;
+  bool        on;
+} sched_job_t;
+
+static sched_job_t jobs[SCHED_JOBS];
+static int         njobs = 0;
+static bool        fast  = true; // boot runs at 178M
+static uint32_t    since = 0;    // tick of last freq change
+static uint64_t    fastticks = 0;
+static uint64_t    slowticks = 0;
+static HANDLE      wake      = NULL;
+
+static uint32_t Now() { return (uint32_t)clock(); }
+
+static void SetFast(bool on) {
+  uint32_t now = Now();
+  if (fast) fastticks += now - since;
+  else
+    slowticks += now - since;
+  since = now;
+
+  if (on == fast) return;
+  fast = on;
+  PM_SetSysMinFreq(on ? PM_SYS_FREQ_178M : PM_SYS_FREQ_32K);
+  if (on) OS_Sleep(SCHED_SETTLE);
+}
+
+int SCHED_Add(const char* name, sched_fn_t fn, uint32_t period, uint8_t flags) {
+  if (njobs >= SCHED_JOBS) return -1;
+  sched_job_t* j = &jobs[njobs];
+  j->name        = name;
+  j->fn          = fn;
+  j->period      = TICKS(period);
+  j->next        = Now();
+  j->flags       = flags;
+  j->on          = true;
+  return njobs++;
+}
+
+void SCHED_Set(int job, uint32_t delay) {
+  if (job < 0) return;
+  jobs[job].next = Now() + TICKS(delay);
+  jobs[job].on   = true;
+}
+
+void SCHED_Poke(int job, uint32_t delay) {
+  SCHED_Set(job, delay);
+  if (wake) OS_ReleaseSemaphore(wake);
+}
+
+void SCHED_Stop(int job) {
+  if (job >= 0) jobs[job].on = false;
+}
+
+void SCHED_Fast() { SetFast(true); }
+
+void SCHED_Run() {
+  since = Now();
+  wake  = OS_CreateSemaphore(0);
+  while (1) {
+    uint32_t now = Now();
+
+    // Sleep through to the earliest deadline
+    int32_t wait = INT32_MAX;
+    for (int i = 0; i < njobs; i++)
+      if (jobs[i].on && (int32_t)(jobs[i].next - now) < wait) wait = jobs[i].next - now;
+    if (wait > 0) {
+      SetFast(false);
+      OS_WaitForSemaphore(wake, wait == INT32_MAX ? 1000 : (uint32_t)(wait / CLOCKS_PER_MSEC) + 1);
+      now = Now();
+    }
+
+    // Batch: anything due, plus heavier jobs that are nearly due
+    uint32_t horizon = now + TICKS(SCHED_BATCH);
+    bool     heavy   = false;
+    for (int i = 0; i < njobs; i++)
+      if (jobs[i].on && !(jobs[i].flags & SCHED_LIGHT) && DUE(jobs[i].next, horizon)) heavy = true;
+    if (heavy) SetFast(true);
+
+    for (int i = 0; i < njobs; i++) {
+      sched_job_t* j = &jobs[i];
+      if (!j->on) continue;
+      if (!DUE(j->next, (j->flags & SCHED_LIGHT) ? now : horizon)) continue;
+
+      if (j->flags & SCHED_ONCE) j->on = false;
+      else if (j->period) {
+        j->next += j->period;
+        if (DUE(j->next, now)) j->next = now + j->period; // overran, don't burst
+      } else
+        j->next = now + TICKS(60 * 1000); // self rescheduling job that didn't
+      j->fn();
+    }
+  }
+}
+
+// Share of time at each cpu floor
+int SCHED_Format(char* buf, int size) {
+  uint64_t f = fastticks, s = slowticks;
+  if (fast) f += Now() - since; // current stretch
+  else
+    s += Now() - since;
+  if (!f && !s) f = 1;
+  return snprintf(buf, size, "cpu 178M %u%% 32K %u%%", (uint32_t)(f * 100 / (f + s)), (uint32_t)(s * 100 / (f + s)));
+}
@@ -0,0 +1,18 @@
+/*
+ * Deadline scheduler for the gprs task periodic jobs
+ */
+
+#define SCHED_JOBS 10
+
+#define SCHED_LIGHT 1 // cheap, doesn't need the cpu floor raised
+#define SCHED_ONCE  2 // one shot, stops after running
+
+typedef void (*sched_fn_t)(void);
+
+int  SCHED_Add(const char* name, sched_fn_t fn, uint32_t period, uint8_t flags); // ms, first run now
+void SCHED_Set(int job, uint32_t delay);  // next run in delay ms
+void SCHED_Poke(int job, uint32_t delay); // SCHED_Set from another task, wakes the scheduler to see it
+void SCHED_Stop(int job);
+void SCHED_Fast();                        // raise cpu floor for the rest of this batch
+void SCHED_Run();                         // never returns
+int  SCHED_Format(char* buf, int size);
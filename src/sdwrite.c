@@ -0,0 +1,294 @@
+/*
+ * Buffered SD writer.
+ *
+ * The GPS log, upload cache and last state were each opened, written and
+ * closed on every update. Here each keeps its handle open and writes go
+ * through a sector sized buffer, reaching the card when a sector fills,
+ * when the oldest buffered byte is past the file's age bound, or at
+ * shutdown. Replace mode files just hold their latest contents until
+ * then. Sizes are tracked in RAM after the first open.
+ *
+ * Writers are on both tasks, so everything is under one mutex.
+ *
+ * Every record is framed so a write torn by power loss can be found.
+ * Append files get a trailer line "~LLLLCCCCCCCC" after each record,
+ * hex length and CRC32 of the record, which text readers skip. Replace
+ * files get the CRC32 appended. At boot the recovery pass reads back
+ * from the end of an append file to the last trailer that checks out
+ * and truncates there, so the work is in the damaged tail only.
+ */
+
+#include <api_fs.h>
+#include <api_os.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "evstats.h"
+#include "mempool.h"
+#include "sdwrite.h"
+
+#define SDW_FILES  4
+#define SDW_SECTOR 512
+#define SDW_SCAN   1024     // recovery read size, and largest record it can check
+#define SDW_TAIL   (4 * SDW_SCAN) // give up looking for a trailer after this, unframed file
+
+typedef struct {
+  const char* path;
+  int32_t     fd; // -1 until needed
+  uint8_t     mode;
+  uint32_t    maxage; // ms
+  uint32_t    since;  // ms, oldest buffered byte
+  int64_t     size;   // on the card, -1 until opened
+  uint16_t    used;
+} sdw_file_t;
+
+static sdw_file_t files[SDW_FILES];
+static uint8_t    buffers[SDW_FILES][SDW_SECTOR];
+static int        nfiles = 0;
+static HANDLE     lock   = NULL;
+
+static struct {
+  uint32_t open, write, flush, close, size, seek;
+} ops;
+
+void SDW_Init() { lock = OS_CreateMutex(); }
+
+int SDW_Open(const char* path, uint8_t mode, uint32_t maxage) {
+  if (nfiles >= SDW_FILES) return -1;
+  sdw_file_t* f = &files[nfiles];
+  f->path       = path;
+  f->fd         = -1;
+  f->mode       = mode;
+  f->maxage     = maxage;
+  f->size       = -1;
+  f->used       = 0;
+  return nfiles++;
+}
+
+static bool Handle(sdw_file_t* f) {
+  if (f->fd > 0) return true;
+  f->fd = API_FS_Open(f->path, FS_O_RDWR | FS_O_CREAT | (f->mode == SDW_APPEND ? FS_O_APPEND : 0), 0);
+  ops.open++;
+  if (f->fd <= 0) {
+    f->fd = -1;
+    return false;
+  }
+  f->size = API_FS_GetFileSize(f->fd);
+  ops.size++;
+  return true;
+}
+
+static bool Flush(sdw_file_t* f, bool sync) {
+  if (f->since && f->used) {
+    if (!Handle(f)) return false;
+    if (f->mode == SDW_REPLACE) { // fixed size records, no truncate needed
+      API_FS_Seek(f->fd, 0, FS_SEEK_SET);
+      ops.seek++;
+    }
+    int32_t n = API_FS_Write(f->fd, buffers[f - files], f->used);
+    ops.write++;
+    if (n != f->used) return false; // keep it, try again next time
+    if (f->mode == SDW_REPLACE) f->size = f->used;
+    else {
+      f->size += f->used;
+      f->used = 0;
+    }
+  }
+  f->since = 0;
+  if (sync && f->fd > 0) {
+    API_FS_Flush(f->fd);
+    ops.flush++;
+  }
+  return true;
+}
+
+static bool Append(sdw_file_t* f, const uint8_t* p, int len) {
+  uint8_t* buf = buffers[f - files];
+  while (len) {
+    int n = SDW_SECTOR - f->used;
+    if (n > len) n = len;
+    memcpy(buf + f->used, p, n);
+    f->used += n;
+    p += n;
+    len -= n;
+    if (f->used == SDW_SECTOR && !(Flush(f, false) && !f->used)) return false;
+  }
+  return true;
+}
+
+// "~LLLLCCCCCCCC\n", fills t and returns its length
+static int Trailer(char* t, const void* data, int len) {
+  return sprintf(t, "~%04x%08x\n", len, (unsigned)CRC32(0, data, len));
+}
+
+bool SDW_Write(int i, const void* data, int len) {
+  if (i < 0 || i >= nfiles) return false;
+  sdw_file_t* f   = &files[i];
+  uint8_t*    buf = buffers[i];
+  uint32_t    crc = CRC32(0, data, len);
+  bool        ret = true;
+  char        trailer[16];
+
+  OS_LockMutex(lock);
+  if (!f->since) f->since = EVS_Now() | 1; // 0 is clean
+  if (f->mode == SDW_REPLACE) {
+    if (len + 4 > SDW_SECTOR) ret = false;
+    else {
+      memcpy(buf, data, len);
+      memcpy(buf + len, &crc, 4);
+      f->used = len + 4;
+    }
+  } else if (len > 0xffff) {
+    ret = false;
+  } else {
+    ret = Append(f, data, len) && Append(f, (uint8_t*)trailer, Trailer(trailer, data, len));
+  }
+  if (f->used && !f->since) f->since = EVS_Now() | 1;
+  OS_UnlockMutex(lock);
+  return ret;
+}
+
+int64_t SDW_Size(int i) {
+  if (i < 0 || i >= nfiles) return -1;
+  sdw_file_t* f = &files[i];
+  OS_LockMutex(lock);
+  Handle(f);
+  int64_t size = f->size < 0 ? -1 : f->mode == SDW_REPLACE ? f->used : f->size + f->used;
+  OS_UnlockMutex(lock);
+  return size;
+}
+
+void SDW_Flush(int i) {
+  if (i < 0 || i >= nfiles) return;
+  OS_LockMutex(lock);
+  Flush(&files[i], false);
+  OS_UnlockMutex(lock);
+}
+
+void SDW_Close(int i) {
+  if (i < 0 || i >= nfiles) return;
+  sdw_file_t* f = &files[i];
+  OS_LockMutex(lock);
+  Flush(f, false);
+  if (f->fd > 0) {
+    API_FS_Close(f->fd);
+    ops.close++;
+  }
+  f->fd   = -1;
+  f->size = -1;
+  f->used = 0; // replace mode contents are on the card now, or lost with the file
+  OS_UnlockMutex(lock);
+}
+
+bool SDW_Remove(int i, int64_t expect) {
+  if (i < 0 || i >= nfiles) return false;
+  sdw_file_t* f = &files[i];
+  OS_LockMutex(lock);
+  Handle(f);
+  bool ret = expect < 0 || f->size + (f->mode == SDW_APPEND ? f->used : 0) == expect;
+  if (ret) {
+    if (f->fd > 0) API_FS_Close(f->fd);
+    API_FS_Delete(f->path);
+    ops.close++;
+    f->fd    = -1;
+    f->size  = -1;
+    f->used  = 0;
+    f->since = 0;
+  }
+  OS_UnlockMutex(lock);
+  return ret;
+}
+
+bool SDW_Load(int i, void* data, int len) {
+  uint8_t buf[SDW_SECTOR];
+  uint32_t crc;
+
+  if (i < 0 || i >= nfiles || len + 4 > SDW_SECTOR) return false;
+  int32_t fd = API_FS_Open(files[i].path, FS_O_RDONLY, 0);
+  if (fd <= 0) return false;
+  int32_t n = API_FS_Read(fd, buf, len + 4);
+  API_FS_Close(fd);
+
+  memcpy(&crc, buf + len, 4);
+  if (n != len + 4 || crc != CRC32(0, buf, len)) return false;
+  memcpy(data, buf, len);
+  return true;
+}
+
+// Trailer ending at end of win, with its record checked, gives the record length or -1
+static int32_t Check(int32_t fd, uint8_t* win, int32_t end, int32_t at, uint8_t* rec) {
+  char     t[16];
+  unsigned len, crc;
+
+  int32_t  t0 = end - 14; // trailer start, must begin a line
+
+  if (win[end - 1] != '\n' || win[t0] != '~' || (at + t0 > 0 && (t0 == 0 || win[t0 - 1] != '\n'))) return -1;
+  memcpy(t, win + end - 13, 12);
+  t[12] = 0;
+  if (sscanf(t, "%4x%8x", &len, &crc) != 2 || len > SDW_SCAN || at + end - 14 < (int32_t)len) return -1;
+
+  API_FS_Seek(fd, at + end - 14 - len, FS_SEEK_SET);
+  if (API_FS_Read(fd, rec, len) != (int32_t)len || CRC32(0, rec, len) != crc) return -1;
+  return len;
+}
+
+int32_t SDW_Recover(int i) {
+  if (i < 0 || i >= nfiles || files[i].mode != SDW_APPEND) return -1;
+  int32_t fd = API_FS_Open(files[i].path, FS_O_RDWR, 0);
+  if (fd <= 0) return 0; // nothing to recover
+  int32_t  size = API_FS_GetFileSize(fd);
+  int32_t  cut  = -1;
+  uint8_t* buf  = POOL_Alloc(2 * SDW_SCAN);
+
+  // Windows overlap by a trailer so one across the boundary is still seen
+  for (int32_t pos = size; buf && cut < 0 && pos > 0 && size - pos < SDW_TAIL; pos -= SDW_SCAN - 14) {
+    int32_t at = pos > SDW_SCAN ? pos - SDW_SCAN : 0;
+    API_FS_Seek(fd, at, FS_SEEK_SET);
+    if (API_FS_Read(fd, buf, pos - at) != pos - at) break;
+    for (int32_t end = pos - at; end >= 14 && cut < 0; end--)
+      if (Check(fd, buf, end, at, buf + SDW_SCAN) >= 0) cut = size - (at + end);
+    if (at == 0) break;
+  }
+  if (cut > 0) API_FS_Ftruncate(fd, size - cut);
+  API_FS_Close(fd);
+  POOL_Free(buf);
+  return size == 0 ? 0 : cut;
+}
+
+int SDW_Unframe(char* text, int len) {
+  int out = 0;
+  for (int i = 0; i < len;) {
+    char* eol  = memchr(text + i, '\n', len - i);
+    int   llen = eol ? eol - (text + i) + 1 : len - i;
+    if (text[i] != '~' || llen != 14) {
+      memmove(text + out, text + i, llen);
+      out += llen;
+    }
+    i += llen;
+  }
+  text[out] = 0;
+  return out;
+}
+
+void SDW_Tick() {
+  uint32_t now = EVS_Now();
+  OS_LockMutex(lock);
+  for (int i = 0; i < nfiles; i++)
+    if (files[i].since && (int32_t)(now - files[i].since) >= (int32_t)files[i].maxage) Flush(&files[i], true);
+  OS_UnlockMutex(lock);
+}
+
+void SDW_FlushAll() {
+  OS_LockMutex(lock);
+  for (int i = 0; i < nfiles; i++) Flush(&files[i], true);
+  OS_UnlockMutex(lock);
+}
+
+int SDW_Format(char* buf, int size) {
+  uint32_t mins = EVS_Now() / 60000 + 1;
+#define PERHOUR(n) (uint32_t)((uint64_t)(n) * 60 / mins)
+  return snprintf(buf, size, "SD/h open %u write %u flush %u close %u size %u seek %u", PERHOUR(ops.open),
+                  PERHOUR(ops.write), PERHOUR(ops.flush), PERHOUR(ops.close), PERHOUR(ops.size), PERHOUR(ops.seek));
+#undef PERHOUR
+}
@@ -0,0 +1,21 @@
+/*
+ * Buffered SD writer, long lived handles on the files written all the time.
+ * Records are framed with a length and CRC so torn writes can be cut off.
+ */
+
+#define SDW_APPEND  0
+#define SDW_REPLACE 1 // each write replaces the whole file
+
+void    SDW_Init();
+int     SDW_Open(const char* path, uint8_t mode, uint32_t maxage); // ms data may sit in RAM, -1 if no slot
+bool    SDW_Write(int f, const void* data, int len);
+int64_t SDW_Size(int f);  // including buffered
+void    SDW_Flush(int f); // before reading the file another way
+void    SDW_Close(int f); // flush and let go, before renaming the file
+bool    SDW_Remove(int f, int64_t expect); // delete, only if still expect bytes unless -1
+void    SDW_Tick();       // periodic, flushes buffers past their age
+void    SDW_FlushAll();   // shutdown
+bool    SDW_Load(int f, void* data, int len); // replace mode record, false if missing or torn
+int32_t SDW_Recover(int f); // boot, before writing, truncates a torn tail, bytes cut or -1 if no good record found
+int     SDW_Unframe(char* text, int len); // drop trailer lines read back, returns new length
+int     SDW_Format(char* buf, int size);
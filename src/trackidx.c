@@ -0,0 +1,311 @@
+/*
+ * Time index over the GPS logs.
+ *
+ * Each rolled log has a line in the master index, TRK_INDEX: its name
+ * and the earliest and latest record times, fixed size and in roll order
+ * so a time is found by binary search over the entries. Beside each log
+ * is a .idx table of time and raw byte offset for every Nth record, so a
+ * query reads the table, seeks straight to the records either side of
+ * the range and streams just that span. Offsets are into the raw text,
+ * for a compressed .lz log the frame holding one is reached by skipping
+ * whole frames by their headers.
+ *
+ * The table for the current log is built in RAM as records are written,
+ * and from the file itself at boot. N starts small and doubles whenever
+ * the table fills, so it always covers the whole log.
+ */
+
+#include <api_fs.h>
+#include <api_os.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "logzip.h"
+#include "lzs.h"
+#include "mempool.h"
+#include "trackidx.h"
+
+#define TRK_MARKS 128 // table entries per log
+#define TRK_EVERY 8   // records per entry to start with
+#define TRK_LINE  160 // longest record
+#define TRK_READ  1024
+
+typedef struct {
+  uint32_t time;   // seconds since 2000
+  uint32_t offset; // raw offset of the record
+} trk_mark_t;
+
+typedef struct {
+  char     name[24]; // gps-YYYYMMDD-HHMMSS
+  uint32_t first, last;
+} trk_file_t;
+
+// Splits a byte stream into lines, tracking where each starts
+typedef struct {
+  char     line[TRK_LINE];
+  int      used;
+  uint32_t at;
+  void (*fn)(const char* line, int len, uint32_t at);
+} trk_lines_t;
+
+static const char* current = NULL;
+static trk_mark_t  marks[TRK_MARKS];
+static int         nmarks  = 0;
+static uint32_t    every   = TRK_EVERY;
+static uint32_t    records = 0;
+static uint32_t    first, last;
+
+// Query in progress
+static uint32_t   qfrom, qto;
+static trk_emit_t qemit;
+static int        qcount;
+
+uint32_t TRK_Time(const char* s) {
+  static const uint16_t days[] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+  int                   v[6];
+
+  for (int i = 0; i < 6; i++) {
+    if (s[2 * i] < '0' || s[2 * i] > '9' || s[2 * i + 1] < '0' || s[2 * i + 1] > '9') return 0;
+    v[i] = (s[2 * i] - '0') * 10 + s[2 * i + 1] - '0';
+  }
+  if (v[1] < 1 || v[1] > 12 || v[2] < 1 || v[2] > 31 || v[3] > 23 || v[4] > 59 || v[5] > 59) return 0;
+
+  uint32_t d = v[0] * 365 + (v[0] + 3) / 4 + days[v[1] - 1] + v[2] - 1 + (v[1] > 2 && v[0] % 4 == 0);
+  return ((d * 24 + v[3]) * 60 + v[4]) * 60 + v[5];
+}
+
+// Time of a "*IVR,imei,YYMMDDhhmmss,..." line, 0 for anything else
+static uint32_t LineTime(const char* line, int len) {
+  if (len < 20 || strncmp(line, "*IVR,", 5)) return 0;
+  const char* p = memchr(line + 5, ',', len - 5);
+  if (!p || line + len - p < 13) return 0;
+  return TRK_Time(p + 1);
+}
+
+static void Feed(trk_lines_t* l, const uint8_t* data, int n) {
+  for (int i = 0; i < n; i++) {
+    if (l->used < TRK_LINE) l->line[l->used] = data[i];
+    l->used++;
+    if (data[i] == '\n') {
+      if (l->used <= TRK_LINE) l->fn(l->line, l->used, l->at); // longer is not a record
+      l->at += l->used;
+      l->used = 0;
+    }
+  }
+}
+
+static void Mark(const char* line, int len, uint32_t at) {
+  uint32_t t = LineTime(line, len);
+  if (!t) return; // trailers, and no fix times
+
+  if (records % every == 0) {
+    if (nmarks == TRK_MARKS) { // thin out to every other entry
+      for (int i = 0; i < TRK_MARKS / 2; i++) marks[i] = marks[2 * i];
+      nmarks = TRK_MARKS / 2;
+      every *= 2;
+    }
+    if (records % every == 0) marks[nmarks++] = (trk_mark_t){t, at};
+  }
+  if (!records || t < first) first = t;
+  if (!records || t > last) last = t;
+  records++;
+}
+
+static void Reset() {
+  nmarks  = 0;
+  every   = TRK_EVERY;
+  records = 0;
+}
+
+void TRK_Load(const char* path) {
+  trk_lines_t l = {.fn = Mark};
+
+  current = path;
+  Reset();
+  int32_t  fd  = API_FS_Open(path, FS_O_RDONLY, 0);
+  uint8_t* buf = POOL_Alloc(TRK_READ);
+  if (fd > 0 && buf) {
+    int32_t n;
+    while ((n = API_FS_Read(fd, buf, TRK_READ)) > 0) Feed(&l, buf, n);
+  }
+  if (fd > 0) API_FS_Close(fd);
+  POOL_Free(buf);
+}
+
+void TRK_Add(const char* text, int len, uint32_t at) {
+  for (int i = 0; i < len;) {
+    const char* eol  = memchr(text + i, '\n', len - i);
+    int         llen = eol ? eol - (text + i) + 1 : len - i;
+    Mark(text + i, llen, at + i);
+    i += llen;
+  }
+}
+
+void TRK_Rolled(const char* path) {
+  trk_file_t f = {.first = first, .last = last};
+  char       idx[64];
+
+  const char* name = strrchr(path, '/');
+  name             = name ? name + 1 : path;
+  int n            = strlen(name) - 4; // .log
+  if (!records || n <= 0 || n >= sizeof(f.name)) {
+    Reset();
+    return;
+  }
+  memcpy(f.name, name, n);
+  snprintf(idx, sizeof(idx), "/t/%s.idx", f.name);
+
+  int32_t fd = API_FS_Open(idx, FS_O_RDWR | FS_O_CREAT | FS_O_TRUNC, 0);
+  if (fd > 0) {
+    API_FS_Write(fd, (uint8_t*)marks, nmarks * sizeof(trk_mark_t));
+    API_FS_Close(fd);
+    fd = API_FS_Open(TRK_INDEX, FS_O_RDWR | FS_O_CREAT | FS_O_APPEND, 0);
+  }
+  if (fd > 0) {
+    int32_t size = API_FS_GetFileSize(fd); // drop a torn entry from last time
+    if (size % sizeof(f)) API_FS_Ftruncate(fd, size - size % sizeof(f));
+    API_FS_Write(fd, (uint8_t*)&f, sizeof(f));
+    API_FS_Close(fd);
+  }
+  Reset();
+}
+
+void TRK_Clear() {
+  API_FS_Delete(TRK_INDEX);
+  Reset();
+}
+
+static void Emit(const char* line, int len, uint32_t at) {
+  uint32_t t = LineTime(line, len);
+  if (t && t >= qfrom && t <= qto) {
+    qemit(line, len);
+    qcount++;
+  }
+}
+
+// Byte span that can hold records in qfrom..qto, end 0 for end of file
+static void Span(const trk_mark_t* m, int n, uint32_t* start, uint32_t* end) {
+  int lo = 0, hi = n;
+  while (lo < hi) { // first entry at or after qfrom, the one before is clear of the range
+    int mid = (lo + hi) / 2;
+    if (m[mid].time < qfrom) lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *start = lo ? m[lo - 1].offset : 0;
+
+  hi = n;
+  while (lo < hi) { // first entry past qto
+    int mid = (lo + hi) / 2;
+    if (m[mid].time <= qto) lo = mid + 1;
+    else
+      hi = mid;
+  }
+  *end = lo < n ? m[lo].offset : 0;
+}
+
+static void StreamLog(int32_t fd, uint32_t start, uint32_t end, uint8_t* buf) {
+  trk_lines_t l = {.at = start, .fn = Emit};
+
+  API_FS_Seek(fd, start, FS_SEEK_SET);
+  while (!end || l.at + l.used < end) {
+    int32_t want = end && end - (l.at + l.used) < TRK_READ ? end - (l.at + l.used) : TRK_READ;
+    int32_t n    = API_FS_Read(fd, buf, want);
+    if (n <= 0) break;
+    Feed(&l, buf, n);
+  }
+}
+
+static void StreamLz(int32_t fd, uint32_t start, uint32_t end, uint8_t* buf) {
+  trk_lines_t l = {.at = start, .fn = Emit};
+  uint8_t     hdr[8];
+  uint8_t*    out = POOL_Alloc(LOGZ_FRAME);
+  uint32_t    raw = 0; // offset of this frame's first byte
+  int32_t     pos = 4; // past the magic
+
+  while (out && (!end || raw < end)) {
+    API_FS_Seek(fd, pos, FS_SEEK_SET);
+    if (API_FS_Read(fd, hdr, sizeof(hdr)) != sizeof(hdr)) break;
+    uint16_t rawlen = hdr[0] | hdr[1] << 8;
+    uint16_t coded  = (hdr[2] | hdr[3] << 8) & ~LOGZ_STORED;
+    pos += sizeof(hdr) + coded;
+    if (raw + rawlen <= start) { // skip by the header alone
+      raw += rawlen;
+      continue;
+    }
+
+    if (coded > LOGZ_FRAME || API_FS_Read(fd, buf, coded) != coded) break;
+    int n = hdr[3] & (LOGZ_STORED >> 8) ? coded : LZS_Decompress(NULL, 0, buf, coded, out, LOGZ_FRAME);
+    if (n != rawlen) break;
+
+    uint32_t skip = start > raw ? start - raw : 0;
+    uint32_t stop = end && end - raw < rawlen ? end - raw : rawlen;
+    Feed(&l, (hdr[3] & (LOGZ_STORED >> 8) ? buf : out) + skip, stop - skip);
+    raw += rawlen;
+  }
+  POOL_Free(out);
+}
+
+// Records in range from one log, as text or else compressed
+static void Stream(const char* log, const char* lz, const trk_mark_t* m, int n) {
+  uint32_t start, end;
+  uint8_t* buf = POOL_Alloc(LOGZ_FRAME);
+  if (!buf) return;
+
+  Span(m, n, &start, &end);
+  int32_t fd = API_FS_Open(log, FS_O_RDONLY, 0);
+  if (fd > 0) StreamLog(fd, start, end, buf);
+  else if (lz && (fd = API_FS_Open(lz, FS_O_RDONLY, 0)) > 0)
+    StreamLz(fd, start, end, buf);
+  if (fd > 0) API_FS_Close(fd);
+  POOL_Free(buf);
+}
+
+static void StreamRolled(const trk_file_t* f) {
+  char        log[64];
+  char        lz[64];
+  trk_mark_t* m = POOL_Alloc(TRK_MARKS * sizeof(trk_mark_t));
+  if (!m) return;
+
+  snprintf(log, sizeof(log), "/t/%s.idx", f->name);
+  int32_t fd = API_FS_Open(log, FS_O_RDONLY, 0);
+  int32_t n  = fd > 0 ? API_FS_Read(fd, (uint8_t*)m, TRK_MARKS * sizeof(trk_mark_t)) : 0;
+  if (fd > 0) API_FS_Close(fd);
+
+  snprintf(log, sizeof(log), "/t/%s.log", f->name);
+  snprintf(lz, sizeof(lz), "/t/%s.lz", f->name);
+  if (n > 0) Stream(log, lz, m, n / sizeof(trk_mark_t));
+  POOL_Free(m);
+}
+
+static bool Entry(int32_t fd, int32_t i, trk_file_t* f) {
+  API_FS_Seek(fd, i * sizeof(trk_file_t), FS_SEEK_SET);
+  return API_FS_Read(fd, (uint8_t*)f, sizeof(trk_file_t)) == sizeof(trk_file_t);
+}
+
+int TRK_Query(uint32_t from, uint32_t to, trk_emit_t emit) {
+  trk_file_t f;
+
+  qfrom  = from;
+  qto    = to;
+  qemit  = emit;
+  qcount = 0;
+
+  int32_t fd = API_FS_Open(TRK_INDEX, FS_O_RDONLY, 0);
+  if (fd > 0) {
+    int32_t n  = API_FS_GetFileSize(fd) / sizeof(trk_file_t);
+    int32_t lo = 0, hi = n;
+    while (lo < hi) { // first log ending at or after from
+      int32_t mid = (lo + hi) / 2;
+      if (Entry(fd, mid, &f) && f.last < from) lo = mid + 1;
+      else
+        hi = mid;
+    }
+    for (; lo < n && Entry(fd, lo, &f) && f.first <= to; lo++)
+      if (f.last >= from) StreamRolled(&f);
+    API_FS_Close(fd);
+  }
+
+  if (current && records && last >= from && first <= to) Stream(current, NULL, marks, nmarks);
+  return qcount;
+}
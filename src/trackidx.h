@@ -0,0 +1,14 @@
+/*
+ * Time index over the GPS logs, for pulling out a stretch of track
+ */
+
+#define TRK_INDEX "/t/tracks.idx"
+
+typedef void (*trk_emit_t)(const char* line, int len);
+
+void     TRK_Load(const char* path);                       // boot, rebuild the table for the current log
+void     TRK_Add(const char* text, int len, uint32_t at);  // records written to the current log at offset at
+void     TRK_Rolled(const char* path);                     // current log renamed to path
+void     TRK_Clear();                                      // all logs deleted
+uint32_t TRK_Time(const char* stamp);                      // YYMMDDhhmmss to seconds since 2000, 0 if not valid
+int      TRK_Query(uint32_t from, uint32_t to, trk_emit_t emit); // stream records in from..to, returns count
@@ -0,0 +1,173 @@
+/*
+ * Software timer wheel.
+ *
+ * Two level hierarchical wheel of TW_RES ms ticks: level 0 holds the next
+ * 64 ticks, level 1 the next 64 * 64, anything further parks in the last
+ * level 1 slot and is re-filed as the wheel turns. Start and cancel are
+ * O(1) list operations.
+ *
+ * The wheel doesn't tick on its own. One OS callback timer is armed for
+ * the next occupied slot, so an idle wheel costs no wakeups. Timers given
+ * slack have their expiry rounded up to a coarser grid, so unrelated
+ * timers tend to land on the same slot and share a wakeup.
+ */
+
+#include <api_os.h>
+#include <stdlib.h>
+
+#include "twheel.h"
+
+#define TW_RES   100 // ms per tick
+#define TW_BITS  6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_MASK  (TW_SLOTS - 1)
+#define TW_CLOCK ((uint32_t)(CLOCKS_PER_MSEC * TW_RES)) // clock() per tick
+
+static tw_timer_t* level0[TW_SLOTS];
+static tw_timer_t* level1[TW_SLOTS];
+static uint32_t    wheel   = 0; // current tick
+static uint32_t    clocked = 0; // clock() at wheel tick, wraps
+static uint32_t    armed   = 0; // tick the OS timer is set for, 0 if none
+static HANDLE      lock    = NULL;
+
+static void Tick(void* param);
+
+static uint32_t ToTicks(uint32_t ms) { return (ms + TW_RES - 1) / TW_RES; }
+
+static void Unlink(tw_timer_t* t) {
+  if (t->next) t->next->prev = t->prev;
+  if (t->prev) t->prev->next = t->next;
+  else
+    *t->slot = t->next;
+  t->next = t->prev = NULL;
+}
+
+static void File(tw_timer_t* t) {
+  uint32_t     delta = t->expires - wheel;
+  tw_timer_t** slot;
+
+  if ((int32_t)delta <= 0) {
+    t->expires = wheel + 1; // overdue, next tick
+    delta      = 1;
+  }
+  if (delta < TW_SLOTS) slot = &level0[t->expires & TW_MASK];
+  else if (delta < TW_SLOTS * TW_SLOTS)
+    slot = &level1[(t->expires >> TW_BITS) & TW_MASK];
+  else // too far out, park and re-file later
+    slot = &level1[((wheel >> TW_BITS) - 1) & TW_MASK];
+
+  t->slot = slot;
+  t->prev = NULL;
+  t->next = *slot;
+  if (t->next) t->next->prev = t;
+  *slot = t;
+}
+
+// Next tick with anything due or to cascade, or 0
+static uint32_t NextDue() {
+  uint32_t due = 0;
+  for (uint32_t i = 1; i < TW_SLOTS && !due; i++)
+    if (level0[(wheel + i) & TW_MASK]) due = wheel + i;
+  for (uint32_t i = 1; i <= TW_SLOTS; i++) {
+    if (!level1[((wheel >> TW_BITS) + i) & TW_MASK]) continue;
+    uint32_t cascade = ((wheel >> TW_BITS) + i) << TW_BITS;
+    if (!due || (int32_t)(cascade - due) < 0) due = cascade;
+    break;
+  }
+  return due;
+}
+
+static void Arm() {
+  uint32_t due = NextDue();
+  if (due == armed) return;
+  OS_StopCallbackTimer(OS_GetUserMainHandle(), Tick, NULL);
+  armed = due;
+  if (due) {
+    uint32_t late = ((uint32_t)clock() - clocked) * TW_RES / TW_CLOCK; // ms since wheel last moved
+    uint32_t ms   = (due - wheel) * TW_RES;
+    OS_StartCallbackTimer(OS_GetUserMainHandle(), ms > late ? ms - late : 1, Tick, NULL);
+  }
+}
+
+// Move the wheel up to real time, firing whatever is due
+static void Tick(void* param) {
+  OS_LockMutex(lock);
+  armed = 0;
+
+  uint32_t ticks = ((uint32_t)clock() - clocked) / TW_CLOCK;
+  clocked += ticks * TW_CLOCK;
+
+  while (ticks--) {
+    wheel++;
+
+    // Cascade the next level 1 slot down as level 0 wraps
+    if ((wheel & TW_MASK) == 0) {
+      tw_timer_t* t = level1[(wheel >> TW_BITS) & TW_MASK];
+      level1[(wheel >> TW_BITS) & TW_MASK] = NULL;
+      while (t) {
+        tw_timer_t* next = t->next;
+        File(t);
+        t = next;
+      }
+    }
+
+    tw_timer_t** slot = &level0[wheel & TW_MASK];
+    while (*slot) {
+      tw_timer_t* t = *slot;
+      Unlink(t);
+      if (t->period) {
+        t->expires = wheel + t->period;
+        File(t);
+      } else
+        t->active = false;
+
+      // Callbacks may start or cancel timers
+      OS_UnlockMutex(lock);
+      t->fn(t->arg);
+      OS_LockMutex(lock);
+    }
+  }
+
+  Arm();
+  OS_UnlockMutex(lock);
+}
+
+void TW_Init() {
+  lock    = OS_CreateMutex();
+  clocked = clock();
+}
+
+void TW_Start(tw_timer_t* t, uint32_t delay, uint32_t period, uint32_t slack, tw_fn_t fn, void* arg) {
+  OS_LockMutex(lock);
+  if (t->active) Unlink(t);
+
+  // Elapsed ticks not yet applied to the wheel still count
+  uint32_t pending = ((uint32_t)clock() - clocked) / TW_CLOCK;
+
+  t->fn      = fn;
+  t->arg     = arg;
+  t->period  = ToTicks(period);
+  t->slack   = ToTicks(slack);
+  t->expires = wheel + pending + ToTicks(delay);
+  if (t->slack) { // round up onto a power of two grid within the slack
+    uint32_t grid = 1;
+    while (grid * 2 <= t->slack + 1) grid *= 2;
+    t->expires = (t->expires + grid - 1) & ~(grid - 1);
+  }
+  t->active = true;
+  File(t);
+  Arm();
+  OS_UnlockMutex(lock);
+}
+
+void TW_Cancel(tw_timer_t* t) {
+  OS_LockMutex(lock);
+  if (t->active) {
+    Unlink(t);
+    t->active = false;
+    Arm();
+  }
+  OS_UnlockMutex(lock);
+}
+
+bool TW_Active(tw_timer_t* t) { return t->active; }
@@ -0,0 +1,22 @@
+/*
+ * Software timer wheel, all timers share one OS callback timer
+ */
+
+typedef void (*tw_fn_t)(void* arg);
+
+typedef struct tw_timer {
+  struct tw_timer* next;
+  struct tw_timer* prev;
+  struct tw_timer** slot; // list head we're on
+  uint32_t         expires; // wheel ticks
+  uint32_t         period;  // wheel ticks, 0 for one shot
+  uint32_t         slack;   // wheel ticks it may be delayed to share a wakeup
+  tw_fn_t          fn;
+  void*            arg;
+  bool             active;
+} tw_timer_t;
+
+void TW_Init(); // callbacks run in the user main task
+void TW_Start(tw_timer_t* t, uint32_t delay, uint32_t period, uint32_t slack, tw_fn_t fn, void* arg); // ms, restarts if active
+void TW_Cancel(tw_timer_t* t);
+bool TW_Active(tw_timer_t* t);
@@ -0,0 +1,198 @@
+/*
+ * Bulk file export over UART1.
+ *
+ * The log command just writes the file out, and at 921600 anything the
+ * host misses is gone without either end knowing. Here the file goes as
+ * numbered blocks, each with its offset and a CRC32, up to a window of
+ * them ahead of the host's last cumulative ack. A NAK resends just that
+ * block, and if the host goes quiet the oldest unacked block is resent
+ * until it answers or we give up. Blocks are read back from SD for a
+ * resend rather than held. The host can ask for any start offset, so an
+ * interrupted export picks up where its copy ends.
+ *
+ * Sending is on its own task so acks, which arrive as UART events on the
+ * main task, are handed over through XFER_Input while it runs. Log
+ * output to the UART is held off for the duration.
+ */
+
+#include <api_fs.h>
+#include <api_os.h>
+#include <api_hal_uart.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "xfer.h"
+
+#define XFER_STACK    2048
+#define XFER_PRIORITY 3    // below the main and gprs tasks
+#define XFER_WAIT     1000 // ms for an ack before resending
+#define XFER_TRIES    10   // resends without progress before giving up
+#define XFER_NAKS     16   // resend requests held between wakes
+#define XFER_HEADER   10   // sync, type, seq, offset, length
+
+static HANDLE start = NULL; // released to begin a transfer
+static HANDLE wake  = NULL; // released on input
+static HANDLE lock  = NULL;
+
+static volatile bool active = false;
+static char          path[64];
+static uint32_t      offset;
+
+// From the host, under lock
+static uint16_t acked;
+static uint16_t naks[XFER_NAKS];
+static int      nnaks;
+static bool     aborted;
+static uint8_t  msg[5];
+static int      msglen;
+
+static uint8_t frame[XFER_HEADER + XFER_BLOCK + 4];
+
+static void Put16(uint8_t* p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void Put32(uint8_t* p, uint32_t v) {
+  Put16(p, v);
+  Put16(p + 2, v >> 16);
+}
+
+static void Send(int len) {
+  Put32(frame + len, CRC32(0, frame, len));
+  UART_Write(UART1, frame, len + 4);
+}
+
+// Block i of the transfer, false if the SD read fails
+static bool Block(int32_t fd, uint32_t size, uint32_t i) {
+  uint32_t at  = offset + i * XFER_BLOCK;
+  uint16_t len = size - at < XFER_BLOCK ? size - at : XFER_BLOCK;
+
+  frame[0] = XFER_SYNC;
+  frame[1] = XFER_DATA;
+  Put16(frame + 2, i);
+  Put32(frame + 4, at);
+  Put16(frame + 8, len);
+  API_FS_Seek(fd, at, FS_SEEK_SET);
+  if (API_FS_Read(fd, frame + XFER_HEADER, len) != len) return false;
+  Send(XFER_HEADER + len);
+  return true;
+}
+
+static void Run() {
+  int32_t  fd     = API_FS_Open(path, FS_O_RDONLY, 0);
+  uint32_t size   = fd > 0 ? API_FS_GetFileSize(fd) : 0;
+  uint32_t blocks = 0, base = 0, next = 0;
+  int      tries  = 0;
+  uint8_t  status = XFER_OK;
+  uint16_t nak[XFER_NAKS];
+  int      n;
+
+  if (offset > size) offset = size;
+  blocks = (size - offset + XFER_BLOCK - 1) / XFER_BLOCK;
+
+  n        = strlen(path);
+  frame[0] = XFER_SYNC;
+  frame[1] = XFER_START;
+  Put32(frame + 2, size);
+  Put32(frame + 6, offset);
+  Put16(frame + 10, XFER_BLOCK);
+  frame[12] = XFER_WINDOW;
+  frame[13] = n;
+  memcpy(frame + 14, path, n);
+  Send(14 + n);
+
+  while (base < blocks && status == XFER_OK) {
+    while (next < blocks && next < base + XFER_WINDOW && status == XFER_OK)
+      if (!Block(fd, size, next++)) status = XFER_EREAD;
+    bool woke = OS_WaitForSemaphore(wake, XFER_WAIT);
+
+    OS_LockMutex(lock);
+    uint32_t ack = base + (uint16_t)(acked - base); // seq is the block number mod 64K
+    memcpy(nak, naks, sizeof(nak));
+    n     = nnaks;
+    nnaks = 0;
+    if (aborted) status = XFER_EABORT;
+    OS_UnlockMutex(lock);
+
+    if (ack > base && ack <= next) {
+      base  = ack;
+      tries = 0;
+    }
+    for (int i = 0; i < n && status == XFER_OK; i++) {
+      uint32_t b = base + (uint16_t)(nak[i] - base);
+      if (b < next && !Block(fd, size, b)) status = XFER_EREAD;
+    }
+    if (!woke && base < blocks && status == XFER_OK) {
+      if (++tries > XFER_TRIES) status = XFER_ETIME;
+      else if (!Block(fd, size, base))
+        status = XFER_EREAD;
+    }
+  }
+  if (fd > 0) API_FS_Close(fd);
+
+  frame[0] = XFER_SYNC;
+  frame[1] = XFER_END;
+  Put32(frame + 2, (base * XFER_BLOCK < size - offset ? base * XFER_BLOCK : size - offset));
+  frame[6] = status;
+  Send(7);
+}
+
+static void Task(void* param) {
+  for (;;) {
+    OS_WaitForSemaphore(start, OS_TIME_OUT_WAIT_FOREVER);
+    Run();
+    active = false;
+  }
+}
+
+void XFER_Init() {
+  start = OS_CreateSemaphore(0);
+  wake  = OS_CreateSemaphore(0);
+  lock  = OS_CreateMutex();
+  OS_CreateTask(Task, NULL, NULL, XFER_STACK, XFER_PRIORITY, 0, 0, "Xfer Task");
+}
+
+bool XFER_Start(const char* file, uint32_t from) {
+  if (active || !start || strlen(file) >= sizeof(path)) return false;
+  int32_t fd = API_FS_Open(file, FS_O_RDONLY, 0);
+  if (fd <= 0) return false;
+  API_FS_Close(fd);
+
+  strcpy(path, file);
+  offset  = from;
+  acked   = 0;
+  nnaks   = 0;
+  aborted = false;
+  msglen  = 0;
+  while (OS_WaitForSemaphore(wake, OS_TIME_OUT_NO_WAIT)) // stale wakes from the last one
+    ;
+  active = true;
+  OS_ReleaseSemaphore(start);
+  return true;
+}
+
+bool XFER_Active() { return active; }
+
+void XFER_Input(const uint8_t* data, int len) {
+  bool any = false;
+
+  OS_LockMutex(lock);
+  for (int i = 0; i < len; i++) {
+    if (!msglen && data[i] != XFER_SYNC) continue; // line noise, or a stray command
+    msg[msglen++] = data[i];
+    if (msglen < sizeof(msg)) continue;
+    msglen = 0;
+    if ((msg[1] ^ msg[2] ^ msg[3] ^ 0xff) != msg[4]) continue;
+
+    uint16_t seq = msg[2] | msg[3] << 8;
+    if (msg[1] == XFER_ACK) acked = seq;
+    else if (msg[1] == XFER_NAK && nnaks < XFER_NAKS)
+      naks[nnaks++] = seq;
+    else if (msg[1] == XFER_ABORT)
+      aborted = true;
+    any = true;
+  }
+  OS_UnlockMutex(lock);
+  if (any) OS_ReleaseSemaphore(wake);
+}
@@ -0,0 +1,26 @@
+/*
+ * Framed, windowed file export over UART1, util/uartget.c is the other end
+ */
+
+#define XFER_SYNC   0xa5
+#define XFER_BLOCK  512 // data bytes per block
+#define XFER_WINDOW 8   // blocks sent ahead of the last ack
+
+// Tracker to host: sync, type, fields little endian, CRC32 of all before it
+#define XFER_START 'S' // u32 size, u32 offset, u16 block, u8 window, u8 name length, name
+#define XFER_DATA  'D' // u16 seq, u32 offset, u16 length, data
+#define XFER_END   'E' // u32 bytes sent, u8 status
+// Host to tracker: sync, type, u16 seq, check (type ^ seq bytes ^ 0xff)
+#define XFER_ACK   'A' // all blocks before seq arrived
+#define XFER_NAK   'N' // resend seq
+#define XFER_ABORT 'Q'
+
+#define XFER_OK      0
+#define XFER_EREAD   1 // SD read failed
+#define XFER_ETIME   2 // host stopped answering
+#define XFER_EABORT  3
+
+void XFER_Init();                                   // boot, starts the transfer task
+bool XFER_Start(const char* path, uint32_t offset); // false if busy or no such file
+bool XFER_Active();                                 // UART1 belongs to a transfer
+void XFER_Input(const uint8_t* data, int len);      // UART1 bytes while active
@@ -0,0 +1,16 @@
+/*
+ * Host stand-in for the few SDK OS calls firmware modules make, so they can
+ * be built into the util tools. The tool provides the definitions.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef void* HANDLE;
+
+HANDLE OS_CreateMutex();
+void   OS_LockMutex(HANDLE mutex);
+void   OS_UnlockMutex(HANDLE mutex);
+void*  OS_Malloc(uint32_t size);
+void   OS_Free(void* block);
@@ -1,30 +1,52 @@
 /*
- * Proof of concept HST flash dump.
- * not fast because runs word at a time.
- * 
-reads from:- 
-  uint32_t addr = 0xa8240000;
-  size_t size = 1024 * 16;
-
-see:
-  https://ai-thinker-open.github.io/GPRS_C_SDK_DOC/zh/more/flash_map.html
-  
-  0xa8 24 0000 < app image (1M)
-  0xa8 3F E000 < factory cfg (8k) <- IMEI is in here
+ * HST flash dump.
+ *
+ *   g++ -o dump dump.c hst.c -lpthread
+ *   ./dump [-d dev]... [-w window] [-b bytes] [-o file] [region | addr:size]
+ *
+ * Regions are named from the flash map in hst.c, default factory, or
+ * given as hex address and size. Data goes to the output file (default
+ * dump.bin) as each read checks out, and the ranges done so far are kept
+ * in file.progress, so running the same dump again after a failure or
+ * ^C carries on with what's missing. The progress file goes once the
+ * dump is complete.
+ *
+ * Keeps up to -w requests in flight, each tagged with the request counter
+ * the target echoes back, so the link stays busy instead of waiting out a
+ * round trip per read. -b asks for that many bytes per request with the
+ * block read command; if the target doesn't answer one it drops back to
+ * word reads. Requests that time out or fail their checksum are sent
+ * again. Prints bytes/s at the end to tune the two.
+ *
+ * Given more than one -d, dumps the same range from each board at once,
+ * a thread per port, into file-<port> (dump-ttyUSB0.bin, ...) with a
+ * progress line for all of them and a result for each at the end.
  */
 
 #include <cstdlib>
 #include <cstring>
 #include <errno.h>
 #include <fcntl.h>
-#include <poll.h>
-#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <termios.h>
 #include <unistd.h>
 
-static int serial_port;
+#include "hst.h"
+
+struct board {
+  const char *dev;
+  char out[256];
+  char progress[270];
+  int fd;
+  readjob job;
+  volatile uint32_t done; // bytes, for the progress line
+  uint32_t left;
+  double secs;
+  char error[300]; // why it stopped, empty once dumped
+};
+
+static bool several; // boards, progress is shown for all together
+
 void dump(uint8_t *buffer, size_t size) {
   printf("Buffer:\n");
   for (int i = 0; i < size; i += 32) {
@@ -42,172 +64,201 @@ void dump(uint8_t *buffer, size_t size) {
   }
 }
 
-void initSerial() {
-  struct termios tty;
-  memset(&tty, 0, sizeof(tty));
-
-  cfsetispeed(&tty, B921600);
-  cfsetospeed(&tty, B921600);
-
-  tty.c_cflag = CS8 | CLOCAL | CREAD;
-  tty.c_iflag = IGNPAR | IXON | IXOFF | IXANY;
+// Progress file: address and size of the dump, then the ranges done
+static void saveProgress(readjob *job) {
+  board *b = (board *)job->ctx;
+  char tmp[280];
+  fsync(b->fd); // data on disk before it's claimed
+  snprintf(tmp, sizeof(tmp), "%s.tmp", b->progress);
+  FILE *f = fopen(tmp, "w");
+  if (!f)
+    return;
+  fprintf(f, "0x%08x 0x%x\n", job->addr, job->size);
+  for (size_t i = 0; i < job->have.size(); i++)
+    fprintf(f, "0x%x 0x%x\n", job->have[i].start, job->have[i].end);
+  fclose(f);
+  rename(tmp, b->progress);
+}
 
-  tty.c_oflag = 0;
-  tty.c_lflag = 0;
+static void loadProgress(readjob *job, const char *path) {
+  uint32_t a, sz, start, end;
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return;
+  if (fscanf(f, "%x %x", &a, &sz) == 2 && a == job->addr && sz == job->size)
+    while (fscanf(f, "%x %x", &start, &end) == 2)
+      if (start < end && end <= job->size)
+        addSpan(job->have, start, end);
+  fclose(f);
+}
 
-  tty.c_cc[VMIN] = 1;
-  tty.c_cc[VTIME] = 0;
-  tty.c_cc[VSTART] = 0x11;
-  tty.c_cc[VSTOP] = 0x13;
+static uint32_t done(readjob *job) {
+  uint32_t n = 0;
+  for (size_t i = 0; i < job->have.size(); i++)
+    n += job->have[i].end - job->have[i].start;
+  return n;
+}
 
-  tcflush(serial_port, TCIFLUSH);
-  tcsetattr(serial_port, TCSANOW, &tty);
+static bool got(readjob *job, uint32_t offset, const uint8_t *data, int len) {
+  board *b = (board *)job->ctx;
+  if (pwrite(b->fd, data, len, offset) != len)
+    return false;
+  b->done += len;
+  return true;
 }
 
-void toXON(uint8_t *in, uint8_t *out, int &len) {
-  int o = 0;
-  for (int i = 0; i < len; i++) {
-    if (in[i] == 0x11 || in[i] == 0x13 || in[i] == 0x5c) {
-      out[o++] = 0x5c;
-      out[o++] = in[i] ^ 0xff;
-    } else
-      out[o++] = in[i];
+static void tick(readjob *job) {
+  saveProgress(job);
+  if (!several) {
+    printf("\r%u/%u bytes", done(job), job->size);
+    fflush(stdout);
   }
-  len = o;
 }
 
-void deXON(uint8_t *in, uint8_t *out, int &len) {
-  int o = 0;
-  for (int i = 0; i < len; i++) {
-    if (in[i] == 0x5c) {
-      out[o++] = in[++i] ^ 0xff;
-    } else
-      out[o++] = in[i];
-  }
-  len = o;
+static const char *portOf(board *b) {
+  const char *slash = strrchr(b->dev, '/');
+  return slash ? slash + 1 : b->dev;
 }
 
-/*  packet      counter
- *      sz      |  / bytes \
- *       \      | |         |  /chksum
- * AD 00 06 FF 67 60 F1 E0 99 70   <read
- */
+static void show(void *arg, char *buf, int len) {
+  board *b = (board *)arg;
+  snprintf(buf, len, "%s %3u%%  ", portOf(b), (uint32_t)(100.0 * b->done / b->job.size));
+}
 
-/* not sure if this works yet */
-bool setWord(uint32_t addr, uint32_t word) {
-  uint8_t req[14];
-  uint8_t req2[28];
-  req[0] = 0xad;
-  req[1] = 0x00;
-  req[2] = 0x0a;
-  req[3] = 0xff;
-  req[4] = 0x82;
-  *(uint32_t *)(&req[5]) = addr;
-  *(uint32_t *)(&req[9]) = word;
-
-  uint8_t ck = 0;
-  for (int i = 0; i < 10; ++i)
-    ck ^= req[i + 3];
-  req[13] = ck; // xor checksum
-  int len = 14;
-  toXON(req, req2, len); // encode
-
-  for (int i = 0; i < len; ++i) {
-    printf("%02x ", req2[i]);
+// Dump the board's range into its file, resuming from its progress file
+static void *dumpBoard(void *arg) {
+  board *b = (board *)arg;
+  readjob &job = b->job;
+
+  snprintf(b->progress, sizeof(b->progress), "%s.progress", b->out);
+  loadProgress(&job, b->progress);
+  b->fd = open(b->out, O_RDWR | O_CREAT | (job.have.empty() ? O_TRUNC : 0), 0644);
+  if (b->fd < 0 || ftruncate(b->fd, job.size) < 0) {
+    snprintf(b->error, sizeof(b->error), "%s: %s", b->out, strerror(errno));
+    return NULL;
+  }
+  job.got = got;
+  job.tick = tick;
+  job.ctx = b;
+  b->done = done(&job);
+  b->left = job.size - b->done;
+
+  hstport *port = openSerial(b->dev);
+  if (!port) {
+    snprintf(b->error, sizeof(b->error), "Unable to open %s", b->dev);
+    close(b->fd);
+    return NULL;
+  }
+  if (job.block > 4 && !blockReads(port, job.addr, job.block)) {
+    if (!several)
+      printf("No answer to block reads, reading words\n");
+    job.block = 4;
+  }
+  if (!several) {
+    printf("\nDumping flash data from 0x%08x to 0x%08x, window %d, %d bytes per read\n", job.addr,
+           job.addr + job.size, job.window, job.block);
+    if (b->left < job.size)
+      printf("Resuming, %u of %u bytes to go\n", b->left, job.size);
   }
 
-  write(serial_port, req2, len);
-  tcdrain(serial_port); // Wait for sent
+  long start = now();
+  bool ok = readFlash(port, &job);
+  b->secs = (now() - start) / 1000.0;
+  closeSerial(port);
+  if (!ok) {
+    saveProgress(&job);
+    snprintf(b->error, sizeof(b->error), "Failure, run again to resume");
+    close(b->fd);
+    return NULL;
+  }
+  fsync(b->fd);
+  close(b->fd);
+  unlink(b->progress);
+  return NULL;
+}
 
-  return true;
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-d dev]... [-w window] [-b bytes] [-o file] [region | addr:size]\nregions:", prog);
+  for (int i = 0; i < nregions; i++)
+    fprintf(stderr, " %s", regions[i].name);
+  fprintf(stderr, "\n");
 }
 
-bool getWord(uint32_t addr, uint8_t *buffer) {
-  static uint8_t count = 0;
-
-  uint8_t req[11];
-  uint8_t req2[22];
-
-  req[0] = 0xad;
-  req[1] = 0x00;
-  req[2] = 0x07;
-  req[3] = 0xff;
-  req[4] = 0x02;
-  *(uint32_t *)(&req[5]) = addr;
-
-  ++count;
-
-  req[9] = count; // Request count
-
-  uint8_t ck = 0;
-  for (int i = 0; i < 7; ++i)
-    ck ^= req[i + 3];
-  req[10] = ck; // xor checksum
-  static int n = 0;
-
-  int len = 11;
-  toXON(req, req2, len);
-
-  write(serial_port, req2, len);
-  tcdrain(serial_port); // Wait for sent
-  usleep(700);
-
-  // Wait and read.
-  uint8_t block[16];
-  uint8_t buf[20];
-  int nread;
-  nread = read(serial_port, buf + n, 16);
-  if (nread > 0) {
-    deXON(buf, block, nread);
-
-    if (*(uint32_t *)(block) == 0xff0600ad) {
-      uint8_t ck = 0;
-      for (int i = 0; i < 6; ++i)
-        ck ^= block[i + 3];
-      if (ck != block[9]) {
-        printf("Check mismatch: %02x %02x\n", ck, block[9]);
-        return false;
-      } else {
-        *(uint32_t *)buffer = *(uint32_t *)(block + 5);
-      }
+int main(int argc, char **argv) {
+  readjob job = {};
+  std::vector<const char *> devs;
+  const char *out = "dump.bin";
+  const char *name = "factory";
+
+  job.window = 8;
+  job.block = 256;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-d") && i + 1 < argc)
+      devs.push_back(argv[++i]);
+    else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+      job.window = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+      job.block = atoi(argv[++i]) & ~3;
+    else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+      out = argv[++i];
+    else if (argv[i][0] != '-')
+      name = argv[i];
+    else {
+      usage(argv[0]);
+      return 1;
     }
   }
-
-  return true;
-}
-
-int main() {
-  serial_port = open("/dev/ttyUSB0", O_RDWR | O_NOCTTY | O_SYNC);
-  if (serial_port < 0) {
-    fprintf(stderr, "Unable to open ttyUSB\n");
-    _exit(-1);
+  if (job.window < 1 || job.window > HST_MAX_WINDOW || job.block < 4 || job.block > HST_MAX_BLOCK) {
+    fprintf(stderr, "window 1-%d, block 4-%d bytes\n", HST_MAX_WINDOW, HST_MAX_BLOCK);
+    return 1;
   }
-  initSerial();
-
-  //  fcntl(serial_port, F_SETFL, FNDELAY);
-
-  // Clear any startup info waiting.
-  tcflush(serial_port, TCIOFLUSH);
-
-  uint32_t addr = 0xa83fe000;
-  size_t size = 1024 * 8;
-
-  printf("\nDumping flash data from 0x%08x to 0x%08x\n", addr, addr + size);
-
-  uint8_t *buffer = (uint8_t *)malloc(size);
-
-  for (size_t word = 0; word < size / 4; word++) {
-
-    if (!getWord(addr + word * 4, &buffer[word * 4])) {
-      printf("Failure\n");
-      return 0;
-    };
+  if (!findRegion(name, &job.addr, &job.size)) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (devs.empty())
+    devs.push_back("/dev/ttyUSB0");
+  several = devs.size() > 1;
+
+  std::vector<board> boards(devs.size());
+  std::vector<void *> ptrs;
+  for (size_t i = 0; i < devs.size(); i++) {
+    board *b = &boards[i];
+    b->dev = devs[i];
+    b->job = job;
+    if (several) { // dump.bin -> dump-ttyUSB0.bin
+      const char *dot = strrchr(out, '.');
+      int stem = dot && dot != out ? dot - out : strlen(out);
+      snprintf(b->out, sizeof(b->out), "%.*s-%s%s", stem, out, portOf(b), out + stem);
+    } else
+      snprintf(b->out, sizeof(b->out), "%s", out);
+    ptrs.push_back(b);
   }
 
-  FILE *f = fopen("dump.bin", "w+");
-  size_t done = fwrite(buffer, size, 1, f);
-  fclose(f);
-
-  close(serial_port);
-  return 0;
+  if (several)
+    fleet(ptrs.data(), ptrs.size(), dumpBoard, show);
+  else
+    dumpBoard(&boards[0]);
+
+  int failed = 0;
+  for (size_t i = 0; i < boards.size(); i++) {
+    board *b = &boards[i];
+    double rate = b->left / (b->secs > 0 ? b->secs : 0.001);
+    if (b->error[0])
+      failed++;
+    if (several) {
+      if (b->error[0])
+        printf("%s: %s\n", portOf(b), b->error);
+      else
+        printf("%s: %u bytes in %.2fs, %.0f bytes/s, %ld sent again\n", portOf(b), b->left, b->secs, rate, b->job.retries);
+      continue;
+    }
+    if (b->job.retries)
+      printf("\n%ld requests sent again\n", b->job.retries);
+    if (b->error[0])
+      printf("%s\n", b->error);
+    else
+      printf("\r%u bytes in %.2fs, %.0f bytes/s\n", b->left, b->secs, rate);
+  }
+  return failed ? 1 : 0;
 }
@@ -0,0 +1,256 @@
+/*
+ * Differential HST flash write.
+ *
+ *   g++ -o flashwrite flashwrite.c hst.c -lpthread
+ *   ./flashwrite [-d dev]... [-w window] [-b bytes] [-n] image [region | addr]
+ *
+ * Reads what's on the target where the image is to go (default the
+ * factory region, a region name from hst.c or a hex address), compares
+ * it word by word and writes only the words that differ, back to back
+ * without waiting on each. The changed words are then read back, and any
+ * that didn't take are written again. -n stops after the compare and
+ * lists the changes.
+ *
+ * HST word writes aren't answered, so the read back is the only check.
+ *
+ * Given more than one -d, writes the image to each board at once, a
+ * thread per port, with a progress line for all of them and a result for
+ * each at the end.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "hst.h"
+
+#define ROUNDS 5 // write and verify passes before giving up
+#define DRAIN  64 // writes between waits for the port to empty
+
+static bool got(readjob *job, uint32_t offset, const uint8_t *data, int len) {
+  memcpy((uint8_t *)job->ctx + offset, data, len);
+  return true;
+}
+
+// Read the words listed, or all of size if none are, into cur
+static bool readBack(hstport *port, readjob *job, const std::vector<uint32_t> &words, uint8_t *cur, long *requests) {
+  job->have.clear();
+  job->ctx = cur;
+  job->requests = job->retries = 0;
+  if (!words.empty()) { // everything else counts as read already
+    uint32_t at = 0;
+    for (size_t i = 0; i < words.size(); i++) {
+      if (words[i] * 4 > at)
+        addSpan(job->have, at, words[i] * 4);
+      at = words[i] * 4 + 4;
+    }
+    if (at < job->size)
+      addSpan(job->have, at, job->size);
+  }
+  bool ok = readFlash(port, job);
+  *requests += job->requests;
+  return ok;
+}
+
+struct board {
+  const char *dev;
+  readjob job;
+  std::vector<uint8_t> cur;
+  std::vector<uint32_t> todo; // word indexes still to write
+  const char *volatile state; // for the progress line
+  uint32_t changed;
+  long requests, writes, retried;
+  double secs;
+  char error[128]; // why it stopped, empty if it ran to the end
+};
+
+static std::vector<uint8_t> want;
+static bool dry, several;
+
+static const char *portOf(board *b) {
+  const char *slash = strrchr(b->dev, '/');
+  return slash ? slash + 1 : b->dev;
+}
+
+static void show(void *arg, char *buf, int len) {
+  board *b = (board *)arg;
+  snprintf(buf, len, "%s %s  ", portOf(b), b->state);
+}
+
+// Compare the board with the image and write what differs
+static void *flashBoard(void *arg) {
+  board *b = (board *)arg;
+  readjob &job = b->job;
+  std::vector<uint32_t> &todo = b->todo;
+
+  b->state = "opening";
+  hstport *port = openSerial(b->dev);
+  if (!port) {
+    snprintf(b->error, sizeof(b->error), "Unable to open %s", b->dev);
+    b->state = "failed";
+    return NULL;
+  }
+  if (job.block > 4 && !blockReads(port, job.addr, job.block)) {
+    if (!several)
+      printf("No answer to block reads, reading words\n");
+    job.block = 4;
+  }
+
+  b->cur.resize(job.size);
+  long start = now();
+  b->state = "reading";
+  if (!readBack(port, &job, todo, b->cur.data(), &b->requests)) {
+    snprintf(b->error, sizeof(b->error), "Failure reading 0x%08x", job.addr);
+    closeSerial(port);
+    b->state = "failed";
+    return NULL;
+  }
+  for (uint32_t w = 0; w < job.size / 4; w++)
+    if (memcmp(&b->cur[w * 4], &want[w * 4], 4))
+      todo.push_back(w);
+  b->changed = todo.size();
+
+  for (int round = 0; round < ROUNDS && !todo.empty() && !dry; round++) {
+    b->state = round ? "retrying" : "writing";
+    for (size_t i = 0; i < todo.size(); i++) {
+      uint32_t word;
+      memcpy(&word, &want[todo[i] * 4], 4);
+      setWord(port, job.addr + todo[i] * 4, word);
+      if (i % DRAIN == DRAIN - 1)
+        drain(port);
+    }
+    drain(port);
+    b->writes += todo.size();
+    if (round)
+      b->retried += todo.size();
+
+    b->state = "verifying";
+    if (!readBack(port, &job, todo, b->cur.data(), &b->requests)) {
+      snprintf(b->error, sizeof(b->error), "Failure reading back 0x%08x", job.addr);
+      break;
+    }
+    std::vector<uint32_t> left;
+    for (size_t i = 0; i < todo.size(); i++)
+      if (memcmp(&b->cur[todo[i] * 4], &want[todo[i] * 4], 4))
+        left.push_back(todo[i]);
+    todo.swap(left);
+  }
+  closeSerial(port);
+  b->secs = (now() - start) / 1000.0;
+  b->state = todo.empty() ? "done" : "failed";
+  return NULL;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-d dev]... [-w window] [-b bytes] [-n] image [region | addr]\nregions:", prog);
+  for (int i = 0; i < nregions; i++)
+    fprintf(stderr, " %s", regions[i].name);
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+  readjob job = {};
+  std::vector<const char *> devs;
+  const char *image = NULL;
+  const char *name = "factory";
+
+  job.window = 8;
+  job.block = 256;
+  job.got = got;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-d") && i + 1 < argc)
+      devs.push_back(argv[++i]);
+    else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+      job.window = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+      job.block = atoi(argv[++i]) & ~3;
+    else if (!strcmp(argv[i], "-n"))
+      dry = true;
+    else if (argv[i][0] != '-' && !image)
+      image = argv[i];
+    else if (argv[i][0] != '-')
+      name = argv[i];
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!image || job.window < 1 || job.window > HST_MAX_WINDOW || job.block < 4 || job.block > HST_MAX_BLOCK) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  uint32_t limit;
+  if (!findRegion(name, &job.addr, &limit)) {
+    if (sscanf(name, "%x", &job.addr) != 1 || job.addr & 3) {
+      usage(argv[0]);
+      return 1;
+    }
+    limit = 0xffffffff - job.addr;
+  }
+
+  FILE *f = fopen(image, "rb");
+  if (!f) {
+    perror(image);
+    return 1;
+  }
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    want.insert(want.end(), buf, buf + n);
+  fclose(f);
+  if (want.empty() || want.size() & 3 || want.size() > limit) {
+    fprintf(stderr, "%s: %zu bytes, must be whole words and fit 0x%x\n", image, want.size(), limit);
+    return 1;
+  }
+  job.size = want.size();
+  if (devs.empty())
+    devs.push_back("/dev/ttyUSB0");
+  several = devs.size() > 1;
+
+  std::vector<board> boards(devs.size());
+  std::vector<void *> ptrs;
+  for (size_t i = 0; i < devs.size(); i++) {
+    boards[i].dev = devs[i];
+    boards[i].job = job;
+    boards[i].state = "";
+    ptrs.push_back(&boards[i]);
+  }
+  if (several)
+    fleet(ptrs.data(), ptrs.size(), flashBoard, show);
+  else
+    flashBoard(&boards[0]);
+
+  int failed = 0;
+  uint32_t words = job.size / 4;
+  for (size_t i = 0; i < boards.size(); i++) {
+    board *b = &boards[i];
+    char who[64] = "";
+    if (several)
+      snprintf(who, sizeof(who), "%s: ", portOf(b));
+    if (b->error[0] && !b->changed) {
+      printf("%s%s\n", who, b->error);
+      failed++;
+      continue;
+    }
+    printf("%s0x%08x: %u words, %u differ\n", who, job.addr, words, b->changed);
+    if (dry) {
+      for (size_t i = 0; i < b->todo.size(); i++) {
+        uint32_t was, is;
+        memcpy(&was, &b->cur[b->todo[i] * 4], 4);
+        memcpy(&is, &want[b->todo[i] * 4], 4);
+        printf("%s0x%08x: %08x -> %08x\n", who, job.addr + b->todo[i] * 4, was, is);
+      }
+      continue;
+    }
+    if (b->error[0])
+      printf("%s%s\n", who, b->error);
+    printf("%s%u words skipped, %u written, %ld retried, %zu failed\n", who, words - b->changed, b->changed,
+           b->retried, b->todo.size());
+    printf("%s%ld writes and %ld reads in %.2fs\n", who, b->writes, b->requests, b->secs);
+    failed += b->error[0] || !b->todo.empty();
+  }
+  return failed ? 1 : 0;
+}
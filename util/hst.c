@@ -0,0 +1,400 @@
+/*
+ * HST debug protocol over the A9G's HST UART, see hst.h.
+ *
+ * see:
+ *   https://ai-thinker-open.github.io/GPRS_C_SDK_DOC/zh/more/flash_map.html
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "hst.h"
+
+#define TIMEOUT 200  // ms before a request is sent again
+#define RETRIES 5
+#define TICK    1000 // ms between job ticks
+
+const region regions[] = {
+    {"firmware", 0xa8000000, 0x240000}, // SDK platform, up to the app
+    {"app", 0xa8240000, 0x100000},      // app image (1M)
+    {"factory", 0xa83fe000, 0x2000},    // factory cfg (8k), IMEI
+    {"flash", 0xa8000000, 0x400000},    // the lot
+};
+const int nregions = sizeof(regions) / sizeof(regions[0]);
+
+long now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+bool findRegion(const char *name, uint32_t *addr, uint32_t *size) {
+  for (int i = 0; i < nregions; i++)
+    if (!strcmp(name, regions[i].name)) {
+      *addr = regions[i].addr;
+      *size = regions[i].size;
+      return true;
+    }
+  return sscanf(name, "%x:%x", addr, size) == 2 && *size && !((*addr | *size) & 3);
+}
+
+void addSpan(spans &s, uint32_t start, uint32_t end) {
+  size_t i = 0;
+  while (i < s.size() && s[i].end < start)
+    i++;
+  span n = {start, end};
+  while (i < s.size() && s[i].start <= end) { // overlaps or touches
+    n.start = s[i].start < n.start ? s[i].start : n.start;
+    n.end = s[i].end > n.end ? s[i].end : n.end;
+    s.erase(s.begin() + i);
+  }
+  s.insert(s.begin() + i, n);
+}
+
+uint32_t missing(const spans &s, uint32_t from, uint32_t size, uint32_t *len) {
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i].end <= from)
+      continue;
+    if (s[i].start <= from) {
+      from = s[i].end;
+      continue;
+    }
+    *len = (s[i].start < size ? s[i].start : size) - from;
+    return from;
+  }
+  *len = from < size ? size - from : 0;
+  return from;
+}
+
+// A read in flight, indexed by its counter
+struct pending {
+  bool used;
+  uint32_t offset; // into the job
+  int len;
+  long sent;
+  int tries;
+};
+
+struct hstport {
+  const char *dev;
+  int fd;
+  uint8_t rx[8192]; // received bytes, unescaped, and the responses in them
+  int rxlen;
+  bool rxesc;
+  pending inflight[256];
+  uint8_t counter;
+  int busy;
+};
+
+static void initSerial(int serial_port) {
+  struct termios tty;
+  memset(&tty, 0, sizeof(tty));
+
+  cfsetispeed(&tty, B921600);
+  cfsetospeed(&tty, B921600);
+
+  tty.c_cflag = CS8 | CLOCAL | CREAD;
+  tty.c_iflag = IGNPAR | IXON | IXOFF | IXANY;
+
+  tty.c_oflag = 0;
+  tty.c_lflag = 0;
+
+  tty.c_cc[VMIN] = 1;
+  tty.c_cc[VTIME] = 0;
+  tty.c_cc[VSTART] = 0x11;
+  tty.c_cc[VSTOP] = 0x13;
+
+  tcflush(serial_port, TCIFLUSH);
+  tcsetattr(serial_port, TCSANOW, &tty);
+}
+
+hstport *openSerial(const char *dev) {
+  int serial_port = open(dev, O_RDWR | O_NOCTTY | O_SYNC);
+  if (serial_port < 0)
+    return NULL;
+  initSerial(serial_port);
+
+  //  fcntl(serial_port, F_SETFL, FNDELAY);
+
+  // Clear any startup info waiting.
+  tcflush(serial_port, TCIOFLUSH);
+
+  hstport *port = new hstport();
+  port->dev = dev;
+  port->fd = serial_port;
+  return port;
+}
+
+void closeSerial(hstport *port) {
+  close(port->fd);
+  delete port;
+}
+
+const char *portName(hstport *port) {
+  const char *slash = strrchr(port->dev, '/');
+  return slash ? slash + 1 : port->dev;
+}
+
+void toXON(uint8_t *in, uint8_t *out, int &len) {
+  int o = 0;
+  for (int i = 0; i < len; i++) {
+    if (in[i] == 0x11 || in[i] == 0x13 || in[i] == 0x5c) {
+      out[o++] = 0x5c;
+      out[o++] = in[i] ^ 0xff;
+    } else
+      out[o++] = in[i];
+  }
+  len = o;
+}
+
+void deXON(uint8_t *in, uint8_t *out, int &len, bool &esc) {
+  int o = 0;
+  for (int i = 0; i < len; i++) {
+    if (esc) {
+      out[o++] = in[i] ^ 0xff;
+      esc = false;
+    } else if (in[i] == 0x5c)
+      esc = true;
+    else
+      out[o++] = in[i];
+  }
+  len = o;
+}
+
+int frame(uint8_t *buf, int sz) {
+  uint8_t ck = 0;
+  buf[0] = 0xad;
+  buf[1] = sz >> 8;
+  buf[2] = sz & 0xff;
+  buf[3] = 0xff;
+  for (int i = 0; i < sz; ++i)
+    ck ^= buf[i + 3];
+  buf[3 + sz] = ck; // xor checksum
+  return 4 + sz;
+}
+
+// Frame, escape and send a request, sz covers the 0xff through the last body byte
+static void send(hstport *port, uint8_t *req, int sz) {
+  uint8_t out[64];
+  int len = frame(req, sz);
+  toXON(req, out, len); // encode
+  write(port->fd, out, len);
+}
+
+bool setWord(hstport *port, uint32_t addr, uint32_t word) {
+  uint8_t req[14];
+  req[4] = HST_WRITE_WORD;
+  memcpy(&req[5], &addr, 4);
+  memcpy(&req[9], &word, 4);
+  send(port, req, 10);
+  return true;
+}
+
+void drain(hstport *port) { tcdrain(port->fd); }
+
+// Wait up to ms for input and take it all in
+static void fill(hstport *port, int ms) {
+  uint8_t raw[4096];
+  struct pollfd pfd = {port->fd, POLLIN, 0};
+  if (poll(&pfd, 1, ms) <= 0)
+    return;
+  int room = sizeof(port->rx) - port->rxlen; // unescaping never grows it
+  int n = read(port->fd, raw, room < (int)sizeof(raw) ? room : sizeof(raw));
+  if (n <= 0)
+    return;
+  deXON(raw, port->rx + port->rxlen, n, port->rxesc);
+  port->rxlen += n;
+}
+
+// Next whole response, counter and data, false when none is waiting
+static bool response(hstport *port, uint8_t *counter, uint8_t *data, int *len, bool *ok) {
+  uint8_t *rx = port->rx;
+  int &rxlen = port->rxlen;
+  for (;;) {
+    int start = 0;
+    while (start < rxlen && rx[start] != 0xad)
+      start++;
+    memmove(rx, rx + start, rxlen - start);
+    rxlen -= start;
+    if (rxlen < 5)
+      return false;
+
+    int sz = (rx[1] << 8) | rx[2];
+    if (sz < 2 || sz > HST_MAX_BLOCK + 2 || rx[3] != 0xff) { // not a frame start after all
+      memmove(rx, rx + 1, --rxlen);
+      continue;
+    }
+    if (rxlen < 4 + sz)
+      return false;
+
+    uint8_t ck = 0;
+    for (int i = 0; i < sz; ++i)
+      ck ^= rx[i + 3];
+    *ok = ck == rx[3 + sz];
+    *counter = rx[4];
+    *len = sz - 2;
+    memcpy(data, rx + 5, *len);
+    memmove(rx, rx + 4 + sz, rxlen - 4 - sz);
+    rxlen -= 4 + sz;
+    return true;
+  }
+}
+
+static void request(hstport *port, uint32_t addr, uint32_t offset, int len, int tries) {
+  uint8_t req[16];
+  int sz;
+
+  uint8_t &counter = port->counter;
+  do
+    ++counter;
+  while (port->inflight[counter].used); // one still waiting after a wrap
+  if (len == 4) {
+    req[4] = HST_READ_WORD;
+    memcpy(&req[5], &addr, 4);
+    req[9] = counter; // Request count
+    sz = 7;
+  } else {
+    req[4] = HST_READ_BLOCK;
+    memcpy(&req[5], &addr, 4);
+    req[9] = len & 0xff;
+    req[10] = len >> 8;
+    req[11] = counter;
+    sz = 9;
+  }
+  send(port, req, sz);
+
+  pending *p = &port->inflight[counter];
+  port->busy += !p->used;
+  *p = {true, offset, len, now(), tries};
+}
+
+bool readFlash(hstport *port, readjob *job) {
+  uint8_t data[HST_MAX_BLOCK + 8];
+  uint32_t next = 0, len;
+  long lasttick = now();
+
+  for (;;) {
+    while (port->busy < job->window && (next = missing(job->have, next, job->size, &len)) < job->size) {
+      if (len > (uint32_t)job->block)
+        len = job->block;
+      request(port, job->addr + next, next, len, 0);
+      job->requests++;
+      next += len;
+    }
+    if (!port->busy)
+      break;
+
+    fill(port, 10);
+    uint8_t c;
+    int n;
+    bool ok;
+    while (response(port, &c, data, &n, &ok)) {
+      pending *p = &port->inflight[c];
+      if (!p->used)
+        continue; // answer to one already sent again
+      p->used = false;
+      port->busy--;
+      if (ok && n == p->len && job->got(job, p->offset, data, n)) {
+        addSpan(job->have, p->offset, p->offset + n);
+      } else {
+        printf("%s: check mismatch at 0x%08x\n", portName(port), job->addr + p->offset);
+        request(port, job->addr + p->offset, p->offset, p->len, p->tries + 1);
+        job->requests++;
+        job->retries++;
+      }
+    }
+
+    long t = now();
+    for (int i = 0; i < 256; i++) {
+      pending *p = &port->inflight[i];
+      if (!p->used || t - p->sent < TIMEOUT)
+        continue;
+      p->used = false;
+      port->busy--;
+      if (p->tries >= RETRIES) {
+        printf("\n%s: no answer for 0x%08x\n", portName(port), job->addr + p->offset);
+        for (int j = 0; j < 256; j++) // drop the rest, late answers are ignored
+          port->inflight[j].used = false;
+        port->busy = 0;
+        return false;
+      }
+      request(port, job->addr + p->offset, p->offset, p->len, p->tries + 1);
+      job->requests++;
+      job->retries++;
+    }
+
+    if (job->tick && t - lasttick > TICK) {
+      job->tick(job);
+      lasttick = t;
+    }
+  }
+  return true;
+}
+
+bool blockReads(hstport *port, uint32_t addr, int block) {
+  uint8_t data[HST_MAX_BLOCK + 8];
+  request(port, addr, 0, block, 0);
+  port->inflight[port->counter].used = false;
+  port->busy = 0;
+
+  long until = now() + 2 * TIMEOUT;
+  while (now() < until) {
+    fill(port, 10);
+    uint8_t c;
+    int len;
+    bool ok;
+    while (response(port, &c, data, &len, &ok))
+      if (c == port->counter && ok && len == block)
+        return true;
+  }
+  return false;
+}
+
+struct worker {
+  pthread_t thread;
+  void *board;
+  void *(*work)(void *);
+  volatile bool done;
+};
+
+static void *runWorker(void *arg) {
+  worker *w = (worker *)arg;
+  w->work(w->board);
+  w->done = true;
+  return NULL;
+}
+
+void fleet(void **boards, int n, void *(*work)(void *), void (*show)(void *board, char *buf, int len)) {
+  std::vector<worker> workers(n);
+  for (int i = 0; i < n; i++) {
+    workers[i].board = boards[i];
+    workers[i].work = work;
+    workers[i].done = false;
+    pthread_create(&workers[i].thread, NULL, runWorker, &workers[i]);
+  }
+  for (int left = n; left;) {
+    char line[1024];
+    int len = 0;
+    left = 0;
+    for (int i = 0; i < n; i++) {
+      show(boards[i], line + len, sizeof(line) - len);
+      len += strlen(line + len);
+      left += !workers[i].done;
+    }
+    printf("\r%.*s", len, line);
+    fflush(stdout);
+    if (left)
+      usleep(TICK * 1000);
+  }
+  printf("\n");
+  for (int i = 0; i < n; i++)
+    pthread_join(workers[i].thread, NULL);
+}
@@ -0,0 +1,75 @@
+/*
+ * HST debug protocol over the A9G's HST UART, shared by the flash tools.
+ *
+ *  packet      counter
+ *      sz      |  / bytes \
+ *       \      | |         |  /chksum
+ * AD 00 06 FF 67 60 F1 E0 99 70   <read
+ *
+ * Frames are escaped for XON/XOFF (toXON). Reads are tagged with a request
+ * counter that comes back in the response, so several can be in flight.
+ * All of that is kept per port, so boards on different ports can be
+ * worked on from their own threads.
+ */
+
+#include <stdint.h>
+#include <vector>
+
+#define HST_READ_WORD  0x02
+#define HST_READ_BLOCK 0x04
+#define HST_WRITE_WORD 0x82
+
+#define HST_MAX_WINDOW 64
+#define HST_MAX_BLOCK  1024
+
+// Named parts of the flash map
+struct region {
+  const char *name;
+  uint32_t addr;
+  uint32_t size;
+};
+extern const region regions[];
+extern const int nregions;
+
+// Region by name, or hex addr:size
+bool findRegion(const char *name, uint32_t *addr, uint32_t *size);
+
+// Byte ranges, kept merged and in order
+struct span {
+  uint32_t start, end;
+};
+typedef std::vector<span> spans;
+
+void addSpan(spans &s, uint32_t start, uint32_t end);
+// First offset at or after from not in s, and how far the gap runs
+uint32_t missing(const spans &s, uint32_t from, uint32_t size, uint32_t *len);
+
+// A windowed read of part of the flash
+struct readjob {
+  uint32_t addr, size;
+  int window, block;
+  spans have; // read already, not asked for
+  bool (*got)(readjob *job, uint32_t offset, const uint8_t *data, int len); // false to ask again
+  void (*tick)(readjob *job);                                               // about once a second
+  void *ctx;
+  long requests, retries;
+};
+
+// One serial port and the requests in flight on it
+struct hstport;
+
+long now(); // ms
+hstport *openSerial(const char *dev); // NULL if it won't open
+void closeSerial(hstport *port);
+const char *portName(hstport *port); // device without the /dev/
+void toXON(uint8_t *in, uint8_t *out, int &len);
+void deXON(uint8_t *in, uint8_t *out, int &len, bool &esc); // esc carries an escape split across reads
+int frame(uint8_t *buf, int sz); // header and checksum around sz bytes from buf[3], total length
+bool setWord(hstport *port, uint32_t addr, uint32_t word); // not answered, check by reading back
+void drain(hstport *port);                                 // until writes are out
+bool blockReads(hstport *port, uint32_t addr, int block);  // target answers block reads of this size
+bool readFlash(hstport *port, readjob *job);               // false if a read goes unanswered
+
+// Several boards at once, work(board) on a thread each, with a line of
+// everyone's progress from show about once a second until all are done
+void fleet(void **boards, int n, void *(*work)(void *), void (*show)(void *board, char *buf, int len));
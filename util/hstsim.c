@@ -0,0 +1,264 @@
+/*
+ * HST target simulator on a pseudo terminal, for running the flash tools
+ * without a board.
+ *
+ *   g++ -o hstsim hstsim.c hst.c -lpthread
+ *   ./hstsim [-a region | addr] [-l us] [-s baud] [-c pct] [-x pct] [-n] [-L link] image
+ *
+ * The image file is the flash from addr (default the start of flash) on,
+ * mapped so word writes land in it. Prints the pty to give the tools with
+ * -d, or links it at -L.
+ *
+ * Each read is answered -l microseconds after its request is in, and
+ * both directions are paced to -s baud (0 for as fast as the pty goes),
+ * so windowed reads overlap the latency as they would on the board.
+ * -c corrupts a byte of that percentage of responses and -x drops them,
+ * -n ignores block reads like a target without them. Reads outside the
+ * image aren't answered. Counts go to stderr after each run of a tool,
+ * once the requests stop for a second.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+#include "hst.h"
+
+#define IDLE 1000 // ms without a request before a run's counts are reported
+
+struct reply {
+  long due; // us
+  std::vector<uint8_t> bytes;
+};
+
+static int master;
+static uint8_t *flash;
+static uint32_t base, size;
+static long latency; // us
+static long baud = 921600;
+static int corrupt, drop;
+static bool noblock;
+
+static std::deque<reply> queue;
+static long txfree, rxfree; // us when each direction of the line is next idle
+static long reads, writes, bytes, corrupted, dropped, ignored;
+
+static long usec() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+// us to send n bytes at 8N1
+static long line(long n) { return baud > 0 ? n * 10000000L / baud : 0; }
+
+static bool inside(uint32_t addr, uint32_t len) {
+  return addr >= base && addr - base <= size && len <= size - (addr - base);
+}
+
+static void answer(long at, uint8_t counter, const uint8_t *data, int len) {
+  uint8_t f[HST_MAX_BLOCK + 8];
+  uint8_t out[2 * (HST_MAX_BLOCK + 8)];
+  f[4] = counter;
+  memcpy(f + 5, data, len);
+  int n = frame(f, len + 2);
+  toXON(f, out, n);
+  reads++;
+  if (rand() % 100 < drop) {
+    dropped++;
+    return;
+  }
+  if (rand() % 100 < corrupt) {
+    out[rand() % n] ^= 1 << (rand() % 8);
+    corrupted++;
+  }
+  queue.push_back({at + latency, std::vector<uint8_t>(out, out + n)});
+}
+
+// Act on one unescaped request, sz as framed, at is when its last byte came in
+static void request(const uint8_t *q, int sz, long at) {
+  uint32_t addr;
+  memcpy(&addr, q + 1, 4);
+  if (q[0] == HST_READ_WORD && sz >= 7 && inside(addr, 4)) {
+    answer(at, q[5], flash + addr - base, 4);
+  } else if (q[0] == HST_READ_BLOCK && sz >= 9 && !noblock) {
+    int len = q[5] | (q[6] << 8);
+    if (len > 0 && len <= HST_MAX_BLOCK && inside(addr, len))
+      answer(at, q[7], flash + addr - base, len);
+    else
+      ignored++;
+  } else if (q[0] == HST_WRITE_WORD && sz >= 10 && inside(addr, 4)) {
+    memcpy(flash + addr - base, q + 5, 4);
+    writes++;
+  } else
+    ignored++;
+}
+
+// Whole requests from the front of in, len is left with what's still partial
+static void requests(uint8_t *in, int &len, int raw) {
+  long t = usec();
+  rxfree = (rxfree > t ? rxfree : t) + line(raw);
+  int pos = 0;
+  for (;;) {
+    while (pos < len && in[pos] != 0xad)
+      pos++;
+    if (len - pos < 4)
+      break;
+    int sz = (in[pos + 1] << 8) | in[pos + 2];
+    if (sz < 2 || sz > 64 || in[pos + 3] != 0xff) { // not a frame start
+      pos++;
+      continue;
+    }
+    if (len - pos < 4 + sz)
+      break;
+    uint8_t ck = 0;
+    for (int i = 0; i < sz; ++i)
+      ck ^= in[pos + 3 + i];
+    if (ck == in[pos + 3 + sz])
+      request(in + pos + 4, sz, rxfree);
+    else
+      ignored++;
+    pos += 4 + sz;
+  }
+  memmove(in, in + pos, len - pos);
+  len -= pos;
+}
+
+// Send whatever's due and the line has time for, us until the next is
+static long send() {
+  long t = usec();
+  while (!queue.empty()) {
+    reply &r = queue.front();
+    long start = r.due > txfree ? r.due : txfree;
+    if (start > t)
+      return start - t;
+    write(master, r.bytes.data(), r.bytes.size());
+    bytes += r.bytes.size();
+    txfree = start + line(r.bytes.size());
+    queue.pop_front();
+  }
+  return -1;
+}
+
+static void report() {
+  if (!reads && !writes && !ignored)
+    return;
+  fprintf(stderr, "%ld reads, %ld writes, %ld ignored; %ld bytes sent, %ld corrupted, %ld dropped\n", reads, writes,
+          ignored, bytes, corrupted, dropped);
+  reads = writes = bytes = corrupted = dropped = ignored = 0;
+  txfree = rxfree = 0;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-a region | addr] [-l us] [-s baud] [-c pct] [-x pct] [-n] [-L link] image\n", prog);
+}
+
+int main(int argc, char **argv) {
+  const char *image = NULL;
+  const char *link = NULL;
+
+  base = regions[nregions - 1].addr;
+  for (int i = 1; i < argc; i++) {
+    uint32_t sz;
+    if (!strcmp(argv[i], "-a") && i + 1 < argc) {
+      if (!findRegion(argv[++i], &base, &sz) && sscanf(argv[i], "%x", &base) != 1) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+      latency = atol(argv[++i]);
+    else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+      baud = atol(argv[++i]);
+    else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+      corrupt = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-x") && i + 1 < argc)
+      drop = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-n"))
+      noblock = true;
+    else if (!strcmp(argv[i], "-L") && i + 1 < argc)
+      link = argv[++i];
+    else if (argv[i][0] != '-' && !image)
+      image = argv[i];
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!image) {
+    usage(argv[0]);
+    return 1;
+  }
+  int fd = open(image, O_RDWR);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < 4) {
+    perror(image);
+    return 1;
+  }
+  size = st.st_size & ~3;
+  flash = (uint8_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (flash == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+    perror("pty");
+    return 1;
+  }
+  struct termios tty;
+  tcgetattr(master, &tty);
+  cfmakeraw(&tty);
+  tcsetattr(master, TCSANOW, &tty);
+  const char *pty = ptsname(master);
+  if (link) {
+    unlink(link);
+    if (symlink(pty, link) < 0) {
+      perror(link);
+      return 1;
+    }
+  }
+  printf("%s\n", pty);
+  fflush(stdout);
+  fprintf(stderr, "0x%08x-0x%08x from %s\n", base, base + size, image);
+
+  // Hold the other side open too, so the master doesn't hang up between runs of the tools
+  int keep = open(pty, O_RDWR | O_NOCTTY);
+  uint8_t raw[4096], in[8192];
+  int len = 0;
+  bool esc = false;
+  long last = usec();
+
+  for (;;) {
+    long wait = send();
+    struct pollfd pfd = {master, POLLIN, 0};
+    if (poll(&pfd, 1, wait < 0 ? IDLE : wait / 1000 + 1) <= 0) {
+      if (queue.empty() && usec() - last > IDLE * 1000L)
+        report(); // the tool's done or given up
+      continue;
+    }
+    int room = sizeof(in) - len;
+    int n = read(master, raw, room < (int)sizeof(raw) ? room : sizeof(raw));
+    if (n <= 0) {
+      usleep(10000);
+      continue;
+    }
+    last = usec();
+    int got = n;
+    deXON(raw, in + len, n, esc);
+    len += n;
+    requests(in, len, got);
+  }
+  close(keep);
+  return 0;
+}
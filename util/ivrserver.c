@@ -0,0 +1,473 @@
+/*
+ * Stand-in tracking server for testing uploads from the tracker.
+ *
+ *   g++ -o ivrserver ivrserver.c ../src/ivrv2.c ../src/lzs.c -lpthread
+ *   ./ivrserver [-p port] [-1] [--loss pct] [--delay ms] [-c "imei command"]...
+ *
+ * Accepts v1 text and v2 sessions over TCP and v2 datagrams over UDP on
+ * the same port (see src/ivrv2.h). Each TCP session gets a thread, so a
+ * tracker holding its connection in live mode doesn't hold up the rest. Prints each record on stdout and bytes
+ * per fix on stderr, with what the same fixes would have cost in v1.
+ * -1 ignores hellos like an old server. --loss drops that percentage of
+ * datagrams and acks, --delay holds each ack back to stand in for radio
+ * latency.
+ *
+ * Fix to arrival latency is worked out from each fixed record's GPS time
+ * (UTC, so the server clock wants to be on NTP) and percentiles printed
+ * every LATEVERY fixes, to compare batch uploads with live mode.
+ *
+ * Commands for the devices are queued with -c or as "imei command" lines
+ * on stdin, * for whichever device polls next, and go out on the next v2
+ * session from that device. Commands sent and the replies that come back
+ * are logged on stderr.
+ */
+
+#include <arpa/inet.h>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/ivrv2.h"
+#include "../src/lzs.h"
+
+struct session {
+  int fd;
+  uint8_t buf[8192]; // receive buffer
+  int len;
+  bool v2;
+  char imei[32];
+  long fixes, wire, v1bytes;
+};
+
+static long totfixes, totwire, totv1;
+
+// Totals, latencies, the command queue and stdout, shared by the session threads
+static pthread_mutex_t shared = PTHREAD_MUTEX_INITIALIZER;
+static bool hellos = true;
+
+// UDP senders, each remembering recent sequence numbers to drop repeats
+#define PEERS 16
+#define SEEN 64
+struct peer {
+  session s;
+  uint32_t seen[SEEN]; // boot << 16 | sequence
+  int nseen;
+};
+static peer peers[PEERS];
+static int npeers;
+
+// Acks held back by --delay
+#define DELAYED 256
+struct delayed {
+  long due;
+  struct sockaddr_in to;
+  uint8_t ack[5];
+};
+static delayed acks[DELAYED];
+static int nacks;
+
+static int loss;
+static int delay;
+
+// Latency of the last SAMPLES fixes, ms
+#define SAMPLES  1024
+#define LATEVERY 10
+static long latencies[SAMPLES];
+static int nlatencies; // taken, the last SAMPLES are kept
+
+// Commands waiting for a device to poll
+#define QUEUED 64
+struct command {
+  char imei[32];
+  char text[256];
+};
+static command queued[QUEUED];
+static int nqueued;
+
+static long now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static bool lost() { return loss && rand() % 100 < loss; }
+
+// Top up the receive buffer, false at end of stream
+static bool fill(session *s) {
+  if (s->len == sizeof(s->buf))
+    return false;
+  int n = recv(s->fd, s->buf + s->len, sizeof(s->buf) - s->len, 0);
+  if (n <= 0)
+    return false;
+  s->len += n;
+  s->wire += n;
+  return true;
+}
+
+static void consume(session *s, int n) {
+  memmove(s->buf, s->buf + n, s->len - n);
+  s->len -= n;
+}
+
+static int ascending(const void *a, const void *b) {
+  long x = *(const long *)a, y = *(const long *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void percentiles() {
+  long sorted[SAMPLES];
+  int n = nlatencies < SAMPLES ? nlatencies : SAMPLES;
+  if (!n)
+    return;
+  memcpy(sorted, latencies, n * sizeof(long));
+  qsort(sorted, n, sizeof(long), ascending);
+  fprintf(stderr, "latency over %d fixes: p50 %ldms, p90 %ldms, p99 %ldms, max %ldms\n", n, sorted[(n - 1) / 2],
+          sorted[(n - 1) * 90 / 100], sorted[(n - 1) * 99 / 100], sorted[n - 1]);
+}
+
+// *IVR,imei,YYMMDDhhmmss,lat,lon,A,... fixed records only, no fix has no useful time
+static void latency(const char *line, int len) {
+  char text[256], fix;
+  struct tm tm = {};
+  snprintf(text, sizeof(text), "%.*s", len, line);
+  const char *stamp = strchr(text + 5, ',');
+  if (!stamp || sscanf(stamp + 1, "%2d%2d%2d%2d%2d%2d,%*[^,],%*[^,],%c", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                       &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &fix) != 7 || fix != 'A')
+    return;
+  tm.tm_year += 100;
+  tm.tm_mon -= 1;
+  latencies[nlatencies++ % SAMPLES] = now() - timegm(&tm) * 1000L;
+  if (nlatencies % LATEVERY == 0)
+    percentiles();
+}
+
+// One v1 record, as the text would have gone over the wire
+static void record(session *s, const char *line, int len) {
+  pthread_mutex_lock(&shared);
+  printf("%.*s\n", len, line);
+  if (strncmp(line, "*IVR,", 5) == 0) {
+    s->fixes++;
+    latency(line, len);
+  }
+  s->v1bytes += len;
+  fflush(stdout);
+  pthread_mutex_unlock(&shared);
+}
+
+// Records are '#' terminated, v1 sends them without newlines
+static void v1(session *s) {
+  do {
+    int start = 0;
+    for (int i = 0; i < s->len; i++) {
+      if (s->buf[i] == '\n' && i == start) {
+        start++;
+      } else if (s->buf[i] == '#') {
+        record(s, (char *)s->buf + start, i + 1 - start);
+        start = i + 1;
+      }
+    }
+    consume(s, start);
+  } while (fill(s));
+}
+
+// "imei command", or "* command" for the next device
+static void queue(const char *line) {
+  const char *sp = strchr(line, ' ');
+  int len = sp ? strcspn(sp + 1, "\r\n") : 0;
+  if (!sp || sp == line || sp - line >= (int)sizeof(queued[0].imei) || !len || len > 255) {
+    fprintf(stderr, "Expected: imei command\n");
+    return;
+  }
+  pthread_mutex_lock(&shared);
+  if (nqueued == QUEUED) {
+    fprintf(stderr, "Queue full\n");
+  } else {
+    command *c = &queued[nqueued++];
+    snprintf(c->imei, sizeof(c->imei), "%.*s", (int)(sp - line), line);
+    snprintf(c->text, sizeof(c->text), "%.*s", len, sp + 1);
+    fprintf(stderr, "%s queued: %s\n", c->imei, c->text);
+  }
+  pthread_mutex_unlock(&shared);
+}
+
+// Lines typed or piped in, whole ones queued, false at end of input
+static bool input(int fd) {
+  static char buf[1024];
+  static int len;
+  int n = read(fd, buf + len, sizeof(buf) - 1 - len);
+  if (n <= 0)
+    return false;
+  len += n;
+  buf[len] = 0;
+  char *line = buf, *eol;
+  while ((eol = strchr(line, '\n'))) {
+    *eol = 0;
+    if (eol > line)
+      queue(line);
+    line = eol + 1;
+  }
+  len -= line - buf;
+  memmove(buf, line, len);
+  if (len == sizeof(buf) - 1)
+    len = 0; // no newline in all that
+  return true;
+}
+
+// Answer a poll with what's queued for the device
+static void commands(session *s) {
+  uint8_t head[2];
+  pthread_mutex_lock(&shared);
+  for (int i = 0; i < nqueued;) {
+    command *c = &queued[i];
+    if (strcmp(c->imei, s->imei) && strcmp(c->imei, "*")) {
+      i++;
+      continue;
+    }
+    head[0] = V2_CMD;
+    head[1] = strlen(c->text);
+    send(s->fd, head, 2, 0);
+    send(s->fd, c->text, head[1], 0);
+    fprintf(stderr, "%s > %s\n", s->imei, c->text);
+    memmove(c, c + 1, (--nqueued - i) * sizeof(*c));
+  }
+  pthread_mutex_unlock(&shared);
+  head[0] = V2_DONE;
+  send(s->fd, head, 1, 0);
+}
+
+static void v2(session *s) {
+  char text[V2_MAXRAW * 4];
+
+  for (;;) {
+    while (s->len < 1 && fill(s))
+      ;
+    if (s->len && s->buf[0] == V2_POLL) {
+      consume(s, 1);
+      commands(s);
+      continue;
+    }
+    if (s->len && s->buf[0] == V2_REPLY) {
+      while (s->len < 3 && fill(s))
+        ;
+      int n = s->len < 3 ? 0 : s->buf[1] | (s->buf[2] << 8);
+      while (s->len >= 3 && s->len < 3 + n && fill(s))
+        ;
+      if (s->len < 3 + n)
+        break;
+      fprintf(stderr, "%s < %.*s\n", s->imei, n, (char *)s->buf + 3);
+      consume(s, 3 + n);
+      continue;
+    }
+    while (s->len < V2_HEADER && fill(s))
+      ;
+    if (s->len < V2_HEADER)
+      break;
+    int coded = (s->buf[3] | (s->buf[4] << 8)) & ~V2_STORED;
+    while (s->len < V2_HEADER + coded && fill(s))
+      ;
+    if (s->len < V2_HEADER + coded)
+      break;
+
+    int n = V2_Unpack(s->imei, s->buf, V2_HEADER + coded, text, sizeof(text));
+    if (n < 0) {
+      fprintf(stderr, "Bad frame from %s\n", s->imei);
+      break;
+    }
+    for (char *line = text, *eol; (eol = strchr(line, '\n')); line = eol + 1)
+      record(s, line, eol - line);
+    consume(s, V2_HEADER + coded);
+  }
+  if (s->len)
+    fprintf(stderr, "%d bytes left over\n", s->len);
+}
+
+static void report(session *s, const char *how, long fixes, long wire, long v1bytes) {
+  if (!fixes)
+    return;
+  pthread_mutex_lock(&shared);
+  fprintf(stderr, "%s %s: %ld fixes, %ld bytes, %.1f bytes/fix (v1 %.1f)\n", s->imei, how, fixes, wire,
+          (double)wire / fixes, (double)v1bytes / fixes);
+  totfixes += fixes;
+  totwire += wire;
+  totv1 += v1bytes;
+  fprintf(stderr, "total: %ld fixes, %.1f bytes/fix, v1 %.1f\n", totfixes, (double)totwire / totfixes,
+          (double)totv1 / totfixes);
+  pthread_mutex_unlock(&shared);
+}
+
+// One TCP session, on its own thread
+static void *serve(void *arg) {
+  int fd = (int)(intptr_t)arg;
+  session *s = (session *)calloc(1, sizeof(session));
+  s->fd = fd;
+  strcpy(s->imei, "?");
+
+  while (s->len < (int)strlen(V2_HELLO) && fill(s))
+    ;
+  if (s->len >= (int)strlen(V2_HELLO) && memcmp(s->buf, V2_HELLO, strlen(V2_HELLO)) == 0) {
+    uint8_t *end;
+    while (!(end = (uint8_t *)memchr(s->buf, '#', s->len)) && fill(s))
+      ;
+    if (end) {
+      int n = end - s->buf - strlen(V2_HELLO);
+      snprintf(s->imei, sizeof(s->imei), "%.*s", n, s->buf + strlen(V2_HELLO));
+      consume(s, end + 1 - s->buf);
+      if (s->len && s->buf[0] == '\n')
+        consume(s, 1);
+      if (hellos) {
+        send(fd, V2_ACCEPT_CMD, strlen(V2_ACCEPT_CMD), 0);
+        s->v2 = true;
+      }
+    }
+  }
+
+  if (s->v2)
+    v2(s);
+  else
+    v1(s);
+
+  report(s, s->v2 ? "v2" : "v1", s->fixes, s->wire, s->v1bytes);
+  close(fd);
+  free(s);
+  return NULL;
+}
+
+static peer *findpeer(const char *imei) {
+  for (int i = 0; i < npeers; i++)
+    if (!strcmp(peers[i].s.imei, imei))
+      return &peers[i];
+  peer *p = &peers[npeers < PEERS ? npeers++ : PEERS - 1];
+  memset(p, 0, sizeof(*p));
+  strcpy(p->s.imei, imei);
+  return p;
+}
+
+static void datagram(int ufd) {
+  uint8_t buf[2048];
+  char text[V2_MAXRAW * 4];
+  char imei[32];
+  struct sockaddr_in from;
+  socklen_t fromlen = sizeof(from);
+
+  int n = recvfrom(ufd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+  if (n < 6 || buf[0] != V2_DGRAM || 6 + buf[5] > n || lost())
+    return;
+  uint16_t boot = buf[1] | (buf[2] << 8);
+  uint16_t seq = buf[3] | (buf[4] << 8);
+  uint32_t id = (uint32_t)boot << 16 | seq;
+  snprintf(imei, sizeof(imei), "%.*s", buf[5], buf + 6);
+
+  peer *p = findpeer(imei);
+  bool repeat = false;
+  for (int i = 0; i < p->nseen && i < SEEN; i++)
+    repeat |= p->seen[i] == id;
+
+  if (!repeat) {
+    int len = V2_Unpack(imei, buf + 6 + buf[5], n - 6 - buf[5], text, sizeof(text));
+    if (len < 0) {
+      fprintf(stderr, "Bad datagram %u/%u from %s\n", boot, seq, imei);
+      return;
+    }
+    p->seen[p->nseen++ % SEEN] = id;
+    long fixes = p->s.fixes, v1bytes = p->s.v1bytes;
+    for (char *line = text, *eol; (eol = strchr(line, '\n')); line = eol + 1)
+      record(&p->s, line, eol - line);
+    p->s.wire += n;
+    report(&p->s, "udp", p->s.fixes - fixes, n, p->s.v1bytes - v1bytes);
+  } else {
+    p->s.wire += n;
+    fprintf(stderr, "%s udp: repeat %u/%u\n", imei, boot, seq);
+  }
+
+  if (lost() || nacks == DELAYED)
+    return;
+  delayed *a = &acks[nacks++];
+  a->due = now() + delay;
+  a->to = from;
+  a->ack[0] = V2_ACK;
+  a->ack[1] = boot & 0xff;
+  a->ack[2] = boot >> 8;
+  a->ack[3] = seq & 0xff;
+  a->ack[4] = seq >> 8;
+}
+
+// Send acks that have served their delay, returns ms to the next one
+static int sendacks(int ufd) {
+  int wait = -1;
+  for (int i = 0; i < nacks;) {
+    long left = acks[i].due - now();
+    if (left <= 0) {
+      sendto(ufd, acks[i].ack, sizeof(acks[i].ack), 0, (struct sockaddr *)&acks[i].to, sizeof(acks[i].to));
+      acks[i] = acks[--nacks];
+    } else {
+      if (wait < 0 || left < wait)
+        wait = left;
+      i++;
+    }
+  }
+  return wait;
+}
+
+int main(int argc, char **argv) {
+  int port = 8181;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-p") && i + 1 < argc)
+      port = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-1"))
+      hellos = false;
+    else if (!strcmp(argv[i], "--loss") && i + 1 < argc)
+      loss = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--delay") && i + 1 < argc)
+      delay = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+      queue(argv[++i]);
+    else {
+      fprintf(stderr, "usage: %s [-p port] [-1] [--loss pct] [--delay ms] [-c \"imei command\"]...\n", argv[0]);
+      return 1;
+    }
+  }
+
+  int lfd = socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  int ufd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 4) < 0 ||
+      bind(ufd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("listen");
+    return 1;
+  }
+  fprintf(stderr, "Listening on %d, loss %d%%, delay %dms\n", port, loss, delay);
+  srand(now());
+
+  struct pollfd fds[3] = {{lfd, POLLIN, 0}, {ufd, POLLIN, 0}, {0, POLLIN, 0}};
+  for (;;) {
+    poll(fds, 3, sendacks(ufd));
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(lfd, NULL, NULL);
+      pthread_t thread;
+      if (fd >= 0 && pthread_create(&thread, NULL, serve, (void *)(intptr_t)fd) == 0)
+        pthread_detach(thread);
+      else if (fd >= 0)
+        close(fd);
+    }
+    if (fds[1].revents & POLLIN)
+      datagram(ufd);
+    if (fds[2].revents && !input(0))
+      fds[2].fd = -1; // stdin closed
+  }
+}
@@ -0,0 +1,164 @@
+/*
+ * Replay signal traces through the firmware's link quality and upload
+ * backoff (src/linkq.c), to tune them without a board.
+ *
+ *   g++ -o linkqsim linkqsim.c ../src/linkq.c
+ *   ./linkqsim [-u upload] [-m maxstale] [-n] [-v] [trace]...
+ *
+ * A trace file is lines of "seconds sq rxqual" as the modem reports them,
+ * sq 99 meaning no network. With no files it runs a few synthetic ones.
+ *
+ * The upload job is modelled the way gps_monitor.c runs it: every -u
+ * seconds, held while the link is poor unless the last upload is older
+ * than -m, backed off after failures, and started straight away when
+ * registration comes back or the link stops being poor (-n leaves that
+ * out, to compare). Prints how long after each recovery the backlog went
+ * up, and with -v each upload attempt.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "../src/linkq.h"
+
+#define REPORT 5  // s between synthetic signal reports
+#define HOLD   30 // s between checks while holding
+
+struct sample {
+  long t;
+  int sq, rxqual;
+};
+typedef std::vector<sample> trace;
+
+static long upload = 300, maxstale = 1800;
+static bool verbose, norestart;
+
+// Signal level at t along a list of (until, sq, rxqual) legs
+static trace legs(const int (*leg)[3], int n) {
+  trace tr;
+  long t = 0;
+  for (int i = 0; i < n; i++)
+    for (; t < leg[i][0]; t += REPORT) {
+      int sq = leg[i][1] == 99 ? 99 : leg[i][1] + rand() % 3 - 1; // a step of noise
+      tr.push_back({t, sq, leg[i][2]});
+    }
+  return tr;
+}
+
+static bool load(const char *path, trace &tr) {
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+  sample s;
+  while (fscanf(f, "%ld %d %d", &s.t, &s.sq, &s.rxqual) == 3)
+    tr.push_back(s);
+  fclose(f);
+  return !tr.empty();
+}
+
+static void run(const char *name, const trace &tr) {
+  long next = 0, last = 0, gap = 0, back = -1;
+  int fails = 0, uploads = 0, failed = 0, holds = 0;
+  bool holding = false, registered = true;
+
+  for (size_t i = 0; i < tr.size(); i++) {
+    long t = tr[i].t;
+    bool was = registered, poor = LINKQ_Poor();
+    registered = tr[i].sq != 99;
+    LINKQ_Signal(tr[i].sq, tr[i].rxqual);
+    if (((registered && !was) || (poor && !LINKQ_Poor())) && (fails || holding)) { // LinkBack
+      back = t;
+      if (!norestart) {
+        next = t;
+        fails = 0;
+      }
+    }
+
+    if (t < next)
+      continue;
+    if (LINKQ_Poor() && t - last < maxstale) {
+      holding = true;
+      holds++;
+      next = t + HOLD;
+      continue;
+    }
+    holding = false;
+    if (!registered) {
+      failed++;
+      next = t + LINKQ_Backoff(++fails) / 1000;
+      if (verbose)
+        printf("  %6lds fail, retry in %lds\n", t, next - t);
+      continue;
+    }
+    if (t - last > gap)
+      gap = t - last;
+    if (back >= 0) {
+      printf("  %s: link back at %lds, uploaded %lds later\n", name, back, t - back);
+      back = -1;
+    }
+    if (verbose) {
+      char q[64];
+      LINKQ_Format(q, sizeof(q));
+      printf("  %6lds upload, %s\n", t, q);
+    }
+    uploads++;
+    fails = 0;
+    last = t;
+    next = t + upload;
+  }
+  printf("%s: %lds, %d uploads, %d failed, %d holds, longest gap %lds\n", name, tr.back().t, uploads, failed,
+         holds, gap);
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-u upload] [-m maxstale] [-n] [-v] [trace]...\n", prog);
+}
+
+int main(int argc, char **argv) {
+  std::vector<const char *> files;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-u") && i + 1 < argc)
+      upload = atol(argv[++i]);
+    else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+      maxstale = atol(argv[++i]);
+    else if (!strcmp(argv[i], "-n"))
+      norestart = true;
+    else if (!strcmp(argv[i], "-v"))
+      verbose = true;
+    else if (argv[i][0] != '-')
+      files.push_back(argv[i]);
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (!files.empty()) {
+    for (size_t i = 0; i < files.size(); i++) {
+      trace tr;
+      if (!load(files[i], tr)) {
+        perror(files[i]);
+        return 1;
+      }
+      run(files[i], tr);
+    }
+    return 0;
+  }
+
+  // The link keeps its smoothed state between runs, so each starts on a good signal
+  srand(1);
+  static const int steady[][3] = {{7200, 20, 1}};
+  static const int fade[][3] = {{1800, 18, 1}, {3600, 6, 3}, {7200, 16, 1}};
+  static const int edge[][3] = {{1800, 18, 1}, {5400, 8, 2}, {7200, 18, 1}};
+  static const int outage[][3] = {{1800, 18, 1}, {3600, 99, 99}, {7200, 18, 1}};
+  static const int longout[][3] = {{1800, 18, 1}, {9000, 99, 99}, {12600, 18, 1}};
+  run("steady", legs(steady, 1));
+  run("fade", legs(fade, 3));
+  run("edge", legs(edge, 3));
+  run("outage 30m", legs(outage, 3));
+  run("outage 2h", legs(longout, 3));
+  return 0;
+}
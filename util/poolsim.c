@@ -0,0 +1,232 @@
+/*
+ * Run the firmware's allocation pattern through the block pool
+ * (src/mempool.c) on a modelled OS heap, to see how the heap fragments
+ * over a long run without a board.
+ *
+ *   gcc -I. -o poolsim poolsim.c ../src/mempool.c
+ *   ./poolsim [-k heap kB] [-t hours] [-u upload] [-b backfill %] [-r roll] [-s seed] [-n]
+ *
+ * The heap is first fit with 8 byte headers, coalescing on free, which is
+ * about the worst a small RTOS heap does. The SDK's own blocks (UART and
+ * network events, socket buffers) always come from it; the firmware's go
+ * through POOL_Alloc, or straight to the heap with -n to compare.
+ *
+ * Each task runs one thing at a time, as SCHED does:
+ *   main  a NMEA event a second, a network event every 10 s, a command
+ *         every 30 minutes, a track query every 3 hours
+ *   gprs  an upload every -u seconds, followed by a backfill slice -b
+ *         percent of the time, and the compression of each log rolled
+ *         every -r minutes
+ * Prints heap free and the smallest the largest free block got every
+ * hour, then the pool's counters and the minimums over the run.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/mempool.h"
+#include "api_os.h"
+
+#define HEAP_MAX (1024 * 1024)
+#define HEADER   8
+#define QUEUE    64 // jobs waiting on a task
+#define HELD     16 // blocks held by a job
+
+// Sizes as the firmware asks for them
+#define BUFFER_SIZE 1024               // sdbuffer and its upload copy
+#define V2_RAW      1024               // V2_MAXRAW
+#define V2_FRAME    (5 + 1024 + 128 + 2) // V2_HEADER + LZS_BOUND(V2_MAXRAW)
+#define BACKFILL    (2048 + 1)
+#define LOGZ_FRAME  2048
+#define TRK_MARKS   (128 * 8)
+#define REPLY_SIZE  256
+#define SOCKET      1460 // SDK send buffer per upload
+
+static uint8_t heap[HEAP_MAX] __attribute__((aligned(8)));
+static int     heapsize = 128 * 1024;
+static bool    nopool;
+
+// First fit heap: each block is a uint32_t size with the low bit for in use
+#define SIZE(p) (*(uint32_t*)(p) & ~1u)
+#define USED(p) (*(uint32_t*)(p) & 1u)
+
+static void HeapInit() { *(uint32_t*)heap = heapsize; }
+
+void* OS_Malloc(uint32_t size) {
+  uint32_t need = (size + HEADER + 7) & ~7u;
+  for (uint8_t* p = heap; p < heap + heapsize; p += SIZE(p)) {
+    if (USED(p)) continue;
+    uint8_t* q = p + SIZE(p); // merge what was freed after
+    while (q < heap + heapsize && !USED(q)) {
+      *(uint32_t*)p += SIZE(q);
+      q = p + SIZE(p);
+    }
+    if (SIZE(p) < need) continue;
+    if (SIZE(p) - need >= 2 * HEADER) {
+      *(uint32_t*)(p + need) = SIZE(p) - need;
+      *(uint32_t*)p          = need;
+    }
+    *(uint32_t*)p |= 1;
+    return p + HEADER;
+  }
+  return NULL;
+}
+
+void OS_Free(void* block) { *(uint32_t*)((uint8_t*)block - HEADER) &= ~1u; }
+
+static void HeapStat(uint32_t* avail, uint32_t* largest) {
+  uint32_t run = 0;
+  *avail = *largest = 0;
+  for (uint8_t* p = heap; p < heap + heapsize; p += SIZE(p)) {
+    if (USED(p)) {
+      run = 0;
+      continue;
+    }
+    *avail += SIZE(p);
+    run += SIZE(p);
+    if (run - HEADER > *largest) *largest = run - HEADER;
+  }
+}
+
+HANDLE OS_CreateMutex() { return (HANDLE)1; }
+void   OS_LockMutex(HANDLE mutex) {}
+void   OS_UnlockMutex(HANDLE mutex) {}
+
+static void* Alloc(uint32_t size, bool sdk) {
+  if (sdk || nopool) return OS_Malloc(size);
+  return POOL_Alloc(size);
+}
+
+static void Free(void* block, bool sdk) {
+  if (sdk || nopool) OS_Free(block);
+  else
+    POOL_Free(block);
+}
+
+// A job allocates its blocks at start and frees them all when it's done
+typedef struct {
+  int      hold; // ms
+  int      n;
+  uint32_t size[HELD];
+  bool     sdk[HELD];
+} job_t;
+
+typedef struct {
+  job_t queue[QUEUE];
+  int   queued;
+  long  until; // busy with the current job
+  void* held[HELD];
+  job_t run;
+} task_t;
+
+static task_t   tasks[2];
+static uint32_t failed; // allocations that got nothing
+
+// Block sizes end with 0, negative for the SDK's own
+static void Queue(int t, int hold, ...) {
+  task_t* task = &tasks[t];
+  if (task->queued == QUEUE) return;
+  job_t*  j = &task->queue[task->queued++];
+  va_list ap;
+  va_start(ap, hold);
+  j->hold = hold;
+  j->n    = 0;
+  for (int size; (size = va_arg(ap, int)) != 0 && j->n < HELD; j->n++) {
+    j->sdk[j->n]  = size < 0;
+    j->size[j->n] = abs(size);
+  }
+  va_end(ap);
+}
+
+static void Step(long now) {
+  for (int t = 0; t < 2; t++) {
+    task_t* task = &tasks[t];
+    if (now < task->until) continue;
+    for (int i = 0; i < task->run.n; i++)
+      if (task->held[i]) Free(task->held[i], task->run.sdk[i]);
+    task->run.n = 0;
+    if (!task->queued) continue;
+    task->run = task->queue[0];
+    memmove(task->queue, task->queue + 1, --task->queued * sizeof(job_t));
+    for (int i = 0; i < task->run.n; i++)
+      if (!(task->held[i] = Alloc(task->run.size[i], task->run.sdk[i]))) failed++;
+    task->until = now + task->run.hold;
+  }
+}
+
+static void usage(const char* prog) {
+  fprintf(stderr, "usage: %s [-k heap kB] [-t hours] [-u upload] [-b backfill %%] [-r roll] [-s seed] [-n]\n", prog);
+}
+
+int main(int argc, char** argv) {
+  long hours = 12, upload = 300, roll = 60;
+  int  backfill = 25;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-k") && i + 1 < argc)
+      heapsize = atoi(argv[++i]) * 1024;
+    else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+      hours = atol(argv[++i]);
+    else if (!strcmp(argv[i], "-u") && i + 1 < argc)
+      upload = atol(argv[++i]);
+    else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+      backfill = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+      roll = atol(argv[++i]);
+    else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+      srand(atoi(argv[++i]));
+    else if (!strcmp(argv[i], "-n"))
+      nopool = true;
+    else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (heapsize < 16 * 1024 || heapsize > HEAP_MAX || upload <= 0 || roll <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  HeapInit();
+  POOL_Init();
+  Alloc(BUFFER_SIZE, false); // sdbuffer, for good
+
+  uint32_t avail, largest, minavail = heapsize, minlargest = heapsize, hourlargest = heapsize;
+  int      zipping = 0; // frames left of the last rolled log
+  for (long now = 0; now <= hours * 3600 * 1000; now++) {
+    if (now % 1000 == 0) {
+      long s = now / 1000;
+      Queue(0, 5, -(300 + rand() % 400), 0); // NMEA burst
+      if (s % 10 == 0) Queue(0, 5, -(32 + rand() % 64), 0);
+      if (s % 1800 == 0) Queue(0, 50, -160, 512, REPLY_SIZE, 0); // SMS command touching config
+      if (s % 10800 == 0) Queue(0, 2000, TRK_MARKS, LOGZ_FRAME, -REPLY_SIZE, 0);
+      if (s % upload == 0) {
+        Queue(1, 1500, BUFFER_SIZE, V2_RAW, V2_FRAME, -SOCKET, 0);
+        if (rand() % 100 < backfill) Queue(1, 2500, BACKFILL, V2_RAW, V2_FRAME, -SOCKET, 0);
+      }
+      if (s && s % (roll * 60) == 0) zipping = 3600 * 80 / LOGZ_FRAME; // an hour of ~80 byte lines
+      if (zipping) {
+        Queue(1, 50, LOGZ_FRAME, LOGZ_FRAME, 0);
+        zipping--;
+      }
+    }
+    Step(now);
+    HeapStat(&avail, &largest);
+    if (avail < minavail) minavail = avail;
+    if (largest < hourlargest) hourlargest = largest;
+    if (now && now % (3600 * 1000) == 0) {
+      printf("%3ldh heap free %6u, largest block at least %6u this hour\n", now / 3600000, avail, hourlargest);
+      if (hourlargest < minlargest) minlargest = hourlargest;
+      hourlargest = heapsize;
+    }
+  }
+
+  char buf[256];
+  POOL_Format(buf, sizeof(buf));
+  printf("%s, %u failed\nheap free at least %u, largest block at least %u\n", nopool ? "no pool" : buf, failed, minavail,
+         minlargest);
+  return 0;
+}
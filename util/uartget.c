@@ -0,0 +1,222 @@
+/*
+ * Host side of the tracker's framed UART file export (src/xfer.h).
+ *
+ *   g++ -o uartget uartget.c ../src/crc32.c
+ *   ./uartget [-d /dev/ttyUSB0] [-o out] [-r] gps-current.log
+ *
+ * Sends the get command, writes blocks into the output file at their
+ * offsets, acks in order and NAKs any block that arrives damaged or is
+ * skipped over. -r resumes from the size of an existing output file.
+ * Reports sustained throughput against the line rate on stderr.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../src/crc32.h"
+#include "../src/xfer.h"
+
+#define BAUD 921600
+#define IDLE 5000 // ms without a byte before giving up
+
+static int serial_port;
+
+static long now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+// Raw 8N1, no flow control, blocks are binary
+void initSerial() {
+  struct termios tty;
+  memset(&tty, 0, sizeof(tty));
+
+  cfsetispeed(&tty, B921600);
+  cfsetospeed(&tty, B921600);
+
+  tty.c_cflag = CS8 | CLOCAL | CREAD;
+  tty.c_iflag = IGNPAR;
+  tty.c_oflag = 0;
+  tty.c_lflag = 0;
+
+  tty.c_cc[VMIN] = 1;
+  tty.c_cc[VTIME] = 0;
+
+  tcflush(serial_port, TCIFLUSH);
+  tcsetattr(serial_port, TCSANOW, &tty);
+}
+
+static uint16_t get16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static uint32_t get32(const uint8_t *p) { return get16(p) | ((uint32_t)get16(p + 2) << 16); }
+
+static void reply(uint8_t type, uint16_t seq) {
+  uint8_t msg[5] = {XFER_SYNC, type, (uint8_t)seq, (uint8_t)(seq >> 8), 0};
+  msg[4] = msg[1] ^ msg[2] ^ msg[3] ^ 0xff;
+  write(serial_port, msg, sizeof(msg));
+}
+
+// Length of the frame at p once its header is in, 0 if not known yet, -1 if not a frame
+static int framelen(const uint8_t *p, int len) {
+  if (len < 2)
+    return 0;
+  switch (p[1]) {
+  case XFER_START:
+    return len < 14 ? 0 : 14 + p[13] + 4;
+  case XFER_DATA:
+    return len < 10 ? 0 : get16(p + 8) > XFER_BLOCK ? -1 : 10 + get16(p + 8) + 4;
+  case XFER_END:
+    return 7 + 4;
+  }
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  const char *dev = "/dev/ttyUSB0";
+  const char *out = NULL;
+  const char *file = NULL;
+  bool resume = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-d") && i + 1 < argc)
+      dev = argv[++i];
+    else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+      out = argv[++i];
+    else if (!strcmp(argv[i], "-r"))
+      resume = true;
+    else if (argv[i][0] != '-' && !file)
+      file = argv[i];
+    else {
+      file = NULL;
+      break;
+    }
+  }
+  if (!file) {
+    fprintf(stderr, "usage: %s [-d dev] [-o out] [-r] file\n", argv[0]);
+    return 1;
+  }
+  if (!out)
+    out = strrchr(file, '/') ? strrchr(file, '/') + 1 : file;
+
+  int fd = open(out, O_WRONLY | O_CREAT | (resume ? 0 : O_TRUNC), 0644);
+  serial_port = open(dev, O_RDWR | O_NOCTTY);
+  if (fd < 0 || serial_port < 0) {
+    perror("open");
+    return 1;
+  }
+  if (isatty(serial_port))
+    initSerial();
+
+  struct stat st;
+  uint32_t from = resume && fstat(fd, &st) == 0 ? st.st_size : 0;
+  char cmd[128];
+  snprintf(cmd, sizeof(cmd), "get %s %u\r\n", file, from);
+  write(serial_port, cmd, strlen(cmd));
+
+  static uint8_t buf[16384];
+  int len = 0;
+  std::vector<bool> got;
+  uint32_t size = 0, blocks = 0, acked = 0, highest = 0;
+  long bytes = 0, naks = 0, bad = 0, repeats = 0, first = 0, last = now();
+  int status = -1;
+
+  while (status < 0) {
+    struct pollfd pfd = {serial_port, POLLIN, 0};
+    if (poll(&pfd, 1, 100) > 0) {
+      int n = read(serial_port, buf + len, sizeof(buf) - len);
+      if (n <= 0)
+        break;
+      len += n;
+      last = now();
+    } else if (now() - last > IDLE) {
+      fprintf(stderr, "No answer from tracker\n");
+      break;
+    }
+
+    int pos = 0;
+    while (pos < len && status < 0) {
+      if (buf[pos] != XFER_SYNC) { // command echo, log lines before the start
+        pos++;
+        continue;
+      }
+      int flen = framelen(buf + pos, len - pos);
+      if (flen == 0 || flen > len - pos)
+        break; // wait for the rest
+      const uint8_t *f = buf + pos;
+      if (flen < 0 || CRC32(0, f, flen - 4) != get32(f + flen - 4)) {
+        if (flen > 0 && f[1] == XFER_DATA && get16(f + 2) < blocks && !got[get16(f + 2)]) {
+          reply(XFER_NAK, get16(f + 2)); // damaged in the data, header looks right
+          naks++;
+        }
+        bad++;
+        pos++; // resync
+        continue;
+      }
+      pos += flen;
+
+      if (f[1] == XFER_START) {
+        size = get32(f + 2);
+        from = get32(f + 6);
+        blocks = (size - from + get16(f + 10) - 1) / get16(f + 10);
+        got.assign(blocks, false);
+        ftruncate(fd, from);
+        fprintf(stderr, "%.*s: %u bytes from %u, block %u, window %u\n", f[13], (const char *)f + 14, size, from,
+                get16(f + 10), f[12]);
+      } else if (f[1] == XFER_DATA) {
+        uint32_t seq = get16(f + 2);
+        if (!first)
+          first = now();
+        if (seq >= blocks || got[seq]) {
+          repeats++;
+        } else {
+          pwrite(fd, f + 10, get16(f + 8), get32(f + 4));
+          got[seq] = true;
+          bytes += get16(f + 8);
+          for (uint32_t s = highest; s < seq; s++) // skipped over, ask again
+            if (!got[s]) {
+              reply(XFER_NAK, s);
+              naks++;
+            }
+          if (seq >= highest)
+            highest = seq + 1;
+        }
+        while (acked < blocks && got[acked])
+          acked++;
+        reply(XFER_ACK, acked);
+      } else if (f[1] == XFER_END) {
+        status = f[6];
+      }
+    }
+    memmove(buf, buf + pos, len - pos);
+    len -= pos;
+  }
+  if (status != XFER_OK && blocks)
+    ftruncate(fd, from + acked * XFER_BLOCK < size ? from + acked * XFER_BLOCK : size); // good up to here, for -r
+  close(fd);
+
+  double secs = first ? (now() - first) / 1000.0 : 0;
+  if (secs > 0)
+    fprintf(stderr, "%ld bytes in %.2fs, %.0f bytes/s, %.0f%% of line rate\n", bytes, secs, bytes / secs,
+            100.0 * bytes / secs / (BAUD / 10));
+  fprintf(stderr, "%ld naks, %ld bad frames, %ld repeats\n", naks, bad, repeats);
+
+  if (status != XFER_OK) {
+    fprintf(stderr, "Transfer %s at %u of %u bytes, -r to resume\n",
+            status == XFER_ETIME    ? "timed out"
+            : status == XFER_EREAD  ? "failed reading SD"
+            : status == XFER_EABORT ? "aborted"
+                                    : "stopped",
+            from + acked * XFER_BLOCK, size);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * Host side decompressor for rolled GPS logs compressed on the SD card.
+ *
+ *   g++ -o unlz unlz.c ../src/lzs.c ../src/crc32.c
+ *   ./unlz gps-20201010-101010.lz [out.log]
+ *
+ * Streams frame by frame, verifying each CRC, and reports ratio and
+ * decode throughput on stderr.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../src/crc32.h"
+#include "../src/logzip.h"
+#include "../src/lzs.h"
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s file.lz [out]\n", argv[0]);
+    return 1;
+  }
+
+  FILE *in = fopen(argv[1], "rb");
+  FILE *out = argc > 2 ? fopen(argv[2], "wb") : stdout;
+  if (!in || !out) {
+    fprintf(stderr, "Unable to open files\n");
+    return 1;
+  }
+
+  char magic[4];
+  if (fread(magic, 4, 1, in) != 1 || memcmp(magic, LOGZ_MAGIC, 4) != 0) {
+    fprintf(stderr, "Not a compressed log\n");
+    return 1;
+  }
+
+  uint8_t hdr[8];
+  uint8_t data[LOGZ_FRAME];
+  uint8_t raw[LOGZ_FRAME];
+  size_t total = 4, rawtotal = 0;
+  int frames = 0;
+  clock_t start = clock();
+
+  while (fread(hdr, sizeof(hdr), 1, in) == 1) {
+    int rawlen = hdr[0] | (hdr[1] << 8);
+    int coded = hdr[2] | (hdr[3] << 8);
+    uint32_t crc = hdr[4] | (hdr[5] << 8) | (hdr[6] << 16) | ((uint32_t)hdr[7] << 24);
+    bool stored = coded & LOGZ_STORED;
+    coded &= ~LOGZ_STORED;
+
+    if (rawlen > LOGZ_FRAME || coded > LOGZ_FRAME || fread(data, coded, 1, in) != 1) {
+      fprintf(stderr, "Truncated frame %d\n", frames);
+      return 1;
+    }
+
+    int len = stored ? coded : LZS_Decompress(NULL, 0, data, coded, raw, sizeof(raw));
+    if (stored) memcpy(raw, data, coded);
+    if (len != rawlen || CRC32(0, raw, len) != crc) {
+      fprintf(stderr, "Bad frame %d\n", frames);
+      return 1;
+    }
+
+    fwrite(raw, len, 1, out);
+    total += sizeof(hdr) + coded;
+    rawtotal += len;
+    frames++;
+  }
+
+  double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+  fprintf(stderr, "%d frames, %zu -> %zu bytes, ratio %.2f, %.1f MB/s\n", frames, total, rawtotal,
+          total ? (double)rawtotal / total : 0, secs > 0 ? rawtotal / secs / 1e6 : 0);
+
+  fclose(in);
+  if (out != stdout)
+    fclose(out);
+  return 0;
+}